@@ -0,0 +1,191 @@
+/*
+ * dwmbar-bench: cost of one sampling tick of the periodic sysfs blocks.
+ *
+ *   dwmbar-bench [read_file|pread|uring] [TICKS] [PATH...]
+ *
+ * Every tick reads all the attributes, as when fan, temperature, power and battery are due at
+ * the same second:
+ *   read_file  fopen/fseek/fread/fclose of each path, the historical path of the callbacks
+ *   pread      one pread() per attribute on fds opened once, the fallback of the sampler
+ *   uring      one io_uring_enter() reading every registered attribute, the sampler
+ * Without a mode the three are run one after the other. The read(2) and pread(2) calls come
+ * from /proc/self/io, which does not count the reads done by io_uring, so the io_uring_enter()
+ * calls are counted separately. Run a single mode under "strace -c -f" to count every syscall.
+ * The paths are looked up below DWMBAR_ROOT like dwmbar does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "utils.h"
+
+#define MAX_PATHS 32
+#define ATTR_LEN  64
+
+static const char* default_paths[] = {
+    "/sys/class/hwmon/*/fan1_input",
+    "/sys/class/hwmon/*/fan2_input",
+    "/sys/class/hwmon/*/temp1_input",
+    "/sys/class/power_supply/BAT0/status",
+    "/sys/class/power_supply/BAT0/current_now",
+    "/sys/class/power_supply/BAT0/voltage_now",
+    "/sys/class/power_supply/BAT0/present",
+    "/sys/class/power_supply/BAT0/capacity",
+};
+
+static char* paths[MAX_PATHS];
+static int fds[MAX_PATHS];
+static char bufs[MAX_PATHS][ATTR_LEN];
+static size_t num_paths = 0;
+static unsigned long long enters = 0;   // io_uring_enter() calls issued
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* read(2)-like syscalls issued by this process so far, io_uring reads excluded */
+static unsigned long long read_syscalls(void)
+{
+    unsigned long long syscr = 0;
+    FILE* io = fopen("/proc/self/io", "r");
+    if(io == NULL){
+        return 0;
+    }
+    char line[128];
+    while(fgets(line, sizeof(line), io)){
+        if(sscanf(line, "syscr: %llu", &syscr) == 1){
+            break;
+        }
+    }
+    fclose(io);
+    return syscr;
+}
+
+static int tick_read_file(void* unused)
+{
+    for(size_t i=0; i < num_paths; ++i){
+        free(read_file(paths[i]));
+    }
+    return 0;
+}
+
+static int tick_pread(void* unused)
+{
+    for(size_t i=0; i < num_paths; ++i){
+        if(pread(fds[i], bufs[i], ATTR_LEN, 0) < 0){
+            perror(paths[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int tick_uring(void* p_ring)
+{
+    Uring* ring = p_ring;
+    for(size_t i=0; i < num_paths; ++i){
+        uring_queue_read(ring, i, bufs[i], ATTR_LEN, i);
+    }
+
+    int err = uring_submit_and_wait(ring, num_paths, 1000);
+    enters += 1;
+    if(err < 0){
+        fprintf(stderr, "io_uring_enter: %s\n", strerror(-err));
+        return -1;
+    }
+
+    uint64_t user_data;
+    int res;
+    size_t completed = 0;
+    while(uring_reap(ring, &user_data, &res)){
+        if(res < 0){
+            fprintf(stderr, "%s: %s\n", paths[user_data], strerror(-res));
+        }
+        completed += 1;
+    }
+    return completed == num_paths ? 0 : -1;
+}
+
+static void run(const char* name, int (*tick)(void*), void* arg, long ticks)
+{
+    // One warm up tick, the first reads of sysfs attributes allocate their buffers
+    if(tick(arg) == -1){
+        fprintf(stderr, "%s: tick failed\n", name);
+        return;
+    }
+
+    const unsigned long long syscr = read_syscalls();
+    const unsigned long long enters_start = enters;
+    const double start = now_us();
+    for(long n=0; n < ticks; ++n){
+        if(tick(arg) == -1){
+            fprintf(stderr, "%s: tick failed\n", name);
+            return;
+        }
+    }
+    const double elapsed = now_us() - start;
+    // The read of /proc/self/io itself is not counted
+    const unsigned long long reads = read_syscalls() - syscr - 1;
+
+    printf("%-10s %zu attributes, %ld ticks: %7.1fus/tick, %5.1f read(2) calls/tick, %4.1f io_uring_enter/tick\n",
+           name, num_paths, ticks, elapsed / ticks, (double)reads / ticks, (double)(enters - enters_start) / ticks);
+}
+
+int main(int argc, char** argv)
+{
+    const char* mode = argc > 1 ? argv[1] : NULL;
+    const long ticks = argc > 2 ? atol(argv[2]) : 1000;
+    if(mode && strcmp(mode, "read_file") && strcmp(mode, "pread") && strcmp(mode, "uring")){
+        fprintf(stderr, "usage: dwmbar-bench [read_file|pread|uring] [TICKS] [PATH...]\n");
+        return 1;
+    }
+
+    glob_t g;
+    const size_t num_patterns = argc > 3 ? argc - 3 : sizeof(default_paths) / sizeof(default_paths[0]);
+    for(size_t i=0; i < num_patterns; ++i){
+        char* pattern = root_path(argc > 3 ? argv[3 + i] : default_paths[i]);
+        if(glob(pattern, 0, NULL, &g) == 0){
+            for(size_t j=0; j < g.gl_pathc && num_paths < MAX_PATHS; ++j){
+                fds[num_paths] = open(g.gl_pathv[j], O_RDONLY | O_CLOEXEC);
+                if(fds[num_paths] == -1){
+                    perror(g.gl_pathv[j]);
+                    continue;
+                }
+                paths[num_paths] = smprintf("%s", g.gl_pathv[j]);
+                num_paths += 1;
+            }
+            globfree(&g);
+        }
+        free(pattern);
+    }
+    if(num_paths == 0){
+        fprintf(stderr, "no attribute found\n");
+        return 1;
+    }
+
+    if(!mode || !strcmp(mode, "read_file")){
+        run("read_file", tick_read_file, NULL, ticks);
+    }
+    if(!mode || !strcmp(mode, "pread")){
+        run("pread", tick_pread, NULL, ticks);
+    }
+    if(!mode || !strcmp(mode, "uring")){
+        Uring ring;
+        if(uring_init(&ring, MAX_PATHS) == -1 || uring_register_files(&ring, fds, num_paths) == -1){
+            fprintf(stderr, "uring: io_uring not available\n");
+            return mode ? 1 : 0;
+        }
+        run("uring", tick_uring, &ring, ticks);
+    }
+    return 0;
+}
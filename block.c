@@ -0,0 +1,135 @@
+#include "block.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Each block has a single producer at a time (the thread running its callback) and a single
+ * reader (the renderer). The producer fills blk->data without holding any lock then
+ * copies it into blk->snapshot under a seqlock, so a slow callback never stalls the
+ * renderer and the renderer never stalls a callback.
+ */
+
+void block_publish(Block* blk)
+{
+    const unsigned int seq = blk->seq;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    __atomic_store_n(&blk->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    blk->snapshot.icon = blk->data.icon;
+    blk->snapshot.color = blk->data.color;
+    blk->snapshot.has_text = blk->data.text != NULL;
+    blk->snapshot.stale = 0;
+    blk->snapshot.value = blk->data.value;
+    blk->snapshot.time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    if(blk->data.text){
+        strncpy(blk->snapshot.text, blk->data.text, BLOCK_TEXT_LEN - 1);
+        blk->snapshot.text[BLOCK_TEXT_LEN - 1] = 0;
+    }else{
+        blk->snapshot.text[0] = 0;
+    }
+
+    __atomic_store_n(&blk->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&blk->published, 1, __ATOMIC_RELEASE);
+
+    if(blk->recorder && !isnan(blk->snapshot.value)){
+        recorder_append(blk->recorder, blk->snapshot.time, blk->snapshot.value);
+    }
+}
+
+/* Mark the published snapshot as stale without touching the scratch data, which may be in use */
+void block_set_stale(Block* blk)
+{
+    const unsigned int seq = blk->seq;
+
+    __atomic_store_n(&blk->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    blk->snapshot.stale = 1;
+
+    __atomic_store_n(&blk->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Whether the producer published at least once, a block only marked stale has no sample yet */
+int block_published(Block* blk)
+{
+    return __atomic_load_n(&blk->published, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copy the last published snapshot if it changed since the last call.
+ * Returns 1 when snapshot was filled, 0 when there is nothing new or when a write is
+ * in progress. In the latter case the producer signals again once it is done,
+ * so the reader never has to spin.
+ */
+int block_read(Block* blk, BlockSnapshot* snapshot)
+{
+    const unsigned int begin = __atomic_load_n(&blk->seq, __ATOMIC_ACQUIRE);
+    if(begin == blk->rendered || (begin & 1)){
+        return 0;
+    }
+
+    memcpy(snapshot, &blk->snapshot, sizeof(*snapshot));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const unsigned int end = __atomic_load_n(&blk->seq, __ATOMIC_RELAXED);
+    if(begin != end){
+        return 0;
+    }
+
+    blk->rendered = begin;
+    return 1;
+}
+
+/* Sequence of the last complete publication, it changes whenever the snapshot does */
+unsigned int block_sequence(Block* blk)
+{
+    return __atomic_load_n(&blk->seq, __ATOMIC_ACQUIRE) & ~1u;
+}
+
+/* Consistent copy of the value and of the stale flag of the snapshot, -1 when there is none */
+static int block_peek(Block* blk, double* value, int* stale)
+{
+    // The producer only holds the seqlock for a few copies, retry a few times
+    for(int i=0; i < 16; ++i){
+        const unsigned int begin = __atomic_load_n(&blk->seq, __ATOMIC_ACQUIRE);
+        if(begin == 0){
+            return -1;
+        }
+        if(begin & 1){
+            continue;
+        }
+
+        *value = blk->snapshot.value;
+        *stale = blk->snapshot.stale;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&blk->seq, __ATOMIC_RELAXED) == begin){
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Last published raw value, NAN when there is none yet. Meant for the listeners of other
+ * blocks: unlike block_read() it leaves the renderer's state alone.
+ */
+double block_value(Block* blk)
+{
+    double value;
+    int stale;
+    return block_peek(blk, &value, &stale) == 0 ? value : NAN;
+}
+
+/* Whether the last read of the block missed its deadline, so that its value is an old one */
+int block_stale(Block* blk)
+{
+    double value;
+    int stale;
+    return block_peek(blk, &value, &stale) == 0 && stale;
+}
@@ -1,23 +1,52 @@
 #ifndef BLOCK_HEADER_TCHEV
 #define BLOCK_HEADER_TCHEV
 
-#include <pthread.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "recorder.h"
+
+#define BLOCK_TEXT_LEN 128
 
 typedef struct {
     char  *icon;
     char  *text;
     char  *color;
+    double value;        // raw numeric sample, NAN when there is none
 } BlockData;
 
+/* Copy of a BlockData as last published by the producer */
+typedef struct {
+    char  *icon;
+    char  *color;
+    int    has_text;
+    int    stale;        // the last read missed its deadline, text is the last good value
+    double value;
+    uint64_t time;       // CLOCK_REALTIME of the publication, in ns
+    char   text[BLOCK_TEXT_LEN];
+} BlockSnapshot;
+
 typedef struct {
+    const char *name;
+    int id;                  // index of the block in the bar
     void* (*listener)(void*);
-    BlockData data;
-    char *string;
-    int new;
-    pthread_mutex_t mutex_data;
+    BlockData data;          // scratch data, only touched by the producer
+    char *string;            // rendered string, only touched by the renderer
+    unsigned int rendered;   // sequence number of the rendered snapshot
+    unsigned int seq;        // seqlock protecting snapshot, odd while a write is in progress
+    int published;           // set by the first block_publish(), unlike seq a stale mark leaves it alone
+    BlockSnapshot snapshot;
+    Recorder *recorder;      // time series of the values, NULL when not recorded
 } Block;
 
-#define BLOCK_DEF(listener) {listener, {NULL, NULL, NULL}, NULL, 0, PTHREAD_MUTEX_INITIALIZER}
+#define BLOCK_DEF(name, listener) {name, -1, listener, {NULL, NULL, NULL, NAN}, NULL, 0, 0, 0, {NULL, NULL, 0, 0, NAN, 0, ""}, NULL}
 
+void block_publish(Block* blk);
+void block_set_stale(Block* blk);
+int block_published(Block* blk);
+int block_read(Block* blk, BlockSnapshot* snapshot);
+double block_value(Block* blk);
+int block_stale(Block* blk);
+unsigned int block_sequence(Block* blk);
 
-#endif // BLOCK_HEADER_TCHEV
\ No newline at end of file
+#endif // BLOCK_HEADER_TCHEV
@@ -0,0 +1,198 @@
+#include "coproc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+
+/*
+ * Long-lived scripts feeding a block, one line of output per update.
+ * The script is started once with "sh -c" and the main loop polls the read end of its
+ * stdout, so an update costs a pipe read instead of a fork and an exec. When the script
+ * dies it is started again, after a delay doubled at each death shortly after a start.
+ */
+
+static time_t now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+void coproc_init(Coproc* coproc, const char* command)
+{
+    coproc->command = command;
+    coproc->pid = -1;
+    coproc->fd = -1;
+    coproc->len = 0;
+    coproc->failures = 0;
+    coproc->started = 0;
+    coproc->restart = now_s();
+}
+
+/* Start the script if it is not running and its restart delay is over, returns -1 on failure */
+int coproc_start(Coproc* coproc)
+{
+    if(coproc->pid != -1 || now_s() < coproc->restart){
+        return 0;
+    }
+
+    int pipefd[2];
+    if(pipe(pipefd) == -1){
+        perror("coproc: pipe");
+        coproc->restart = now_s() + COPROC_MAX_DELAY;
+        return -1;
+    }
+
+    // Only the main thread forks, the other scripts must not inherit this pipe
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if(pid == -1){
+        perror("coproc: fork");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        coproc->restart = now_s() + COPROC_MAX_DELAY;
+        return -1;
+    }
+    if(pid == 0){
+        // Own process group, so that the whole pipeline of the script can be killed,
+        // and no script survives dwmbar
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        int null = open("/dev/null", O_RDONLY);
+        if(null != -1){
+            dup2(null, STDIN_FILENO);
+        }
+        dup2(pipefd[1], STDOUT_FILENO);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execl("/bin/sh", "sh", "-c", coproc->command, (char*)NULL);
+        _exit(127);
+    }
+
+    // Also from the parent, so that the group exists before a kill(-pid) even if the child
+    // did not run yet. Fails harmlessly once the child has called exec
+    setpgid(pid, pid);
+    close(pipefd[1]);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    coproc->pid = pid;
+    coproc->fd = pipefd[0];
+    coproc->len = 0;
+    coproc->started = now_s();
+    debug_printf("[coproc]: started '%s' as %d\n", coproc->command, pid);
+    return 0;
+}
+
+static void coproc_stop(Coproc* coproc)
+{
+    // The script closed its stdout, kill what remains of it
+    kill(-coproc->pid, SIGKILL);
+    int status;
+    while(waitpid(coproc->pid, &status, 0) == -1 && errno == EINTR);
+    close(coproc->fd);
+    fprintf(stderr, "coproc: '%s' exited\n", coproc->command);
+
+    if(now_s() - coproc->started >= COPROC_MAX_DELAY){
+        coproc->failures = 0;
+    }
+    const time_t delay = coproc->failures < 6 ? 1 << coproc->failures : COPROC_MAX_DELAY;
+    coproc->restart = now_s() + (delay < COPROC_MAX_DELAY ? delay : COPROC_MAX_DELAY);
+    coproc->failures += 1;
+    coproc->pid = -1;
+    coproc->fd = -1;
+}
+
+/*
+ * Read what the script printed. Returns 1 and copies the last complete line in line,
+ * without its newline, 0 when no line is complete, -1 when the script exited.
+ */
+int coproc_read(Coproc* coproc, char* line, size_t size)
+{
+    if(coproc->fd == -1){
+        return 0;
+    }
+
+    int found = 0;
+    while(1){
+        ssize_t len = read(coproc->fd, coproc->buf + coproc->len, sizeof(coproc->buf) - coproc->len);
+        if(len == -1 && errno == EINTR){
+            continue;
+        }
+        if(len == -1 && errno == EAGAIN){
+            return found;
+        }
+        if(len <= 0){
+            coproc_stop(coproc);
+            return found ? found : -1;
+        }
+        coproc->len += len;
+
+        // Only the most recent line matters, a longer line than the buffer is cut
+        char* eol;
+        while((eol = memchr(coproc->buf, '\n', coproc->len)) != NULL || coproc->len == sizeof(coproc->buf)){
+            const size_t line_len = eol ? (size_t)(eol - coproc->buf) : coproc->len;
+            const size_t copied = line_len < size - 1 ? line_len : size - 1;
+            memcpy(line, coproc->buf, copied);
+            line[copied] = 0;
+            found = 1;
+
+            const size_t consumed = eol ? line_len + 1 : line_len;
+            coproc->len -= consumed;
+            memmove(coproc->buf, coproc->buf + consumed, coproc->len);
+        }
+    }
+}
+
+static Coproc* exit_coprocs;
+static size_t exit_num_coprocs;
+
+static void coproc_terminate(int sig)
+{
+    // Only the first process of a script dies with dwmbar, kill the rest of its pipeline
+    for(size_t i=0; i < exit_num_coprocs; ++i){
+        const pid_t pid = exit_coprocs[i].pid;
+        if(pid > 0){
+            kill(-pid, SIGTERM);
+        }
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Kill the scripts when dwmbar is terminated by SIGTERM, SIGINT or SIGHUP */
+void coproc_kill_on_exit(Coproc* coprocs, size_t num_coprocs)
+{
+    exit_coprocs = coprocs;
+    exit_num_coprocs = num_coprocs;
+
+    const int signals[] = {SIGTERM, SIGINT, SIGHUP};
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = coproc_terminate;
+    sigemptyset(&sa.sa_mask);
+    for(size_t i=0; i < sizeof(signals) / sizeof(signals[0]); ++i){
+        if(sigaction(signals[i], &sa, NULL) == -1){
+            perror("sigaction");
+        }
+    }
+}
+
+/* ms before the script must be started again, -1 when it is running */
+long coproc_timeout(Coproc* coproc)
+{
+    if(coproc->pid != -1){
+        return -1;
+    }
+    const time_t left = coproc->restart - now_s();
+    return left > 0 ? left * 1000 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef COPROC_HEADER_TCHEV
+#define COPROC_HEADER_TCHEV
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define COPROC_LINE_LEN  256
+#define COPROC_MAX_DELAY 60   // s, longest wait before a restart, and lifetime after which a process is healthy
+
+typedef struct {
+    const char* command;
+    pid_t pid;                 // -1 when not running
+    int fd;                    // read end of its stdout, -1 when not running
+    char buf[COPROC_LINE_LEN]; // incomplete line
+    size_t len;
+    unsigned int failures;     // consecutive deaths shortly after a start
+    time_t started;            // monotonic time of the last start
+    time_t restart;            // monotonic time of the next start
+} Coproc;
+
+void coproc_init(Coproc* coproc, const char* command);
+int coproc_start(Coproc* coproc);
+int coproc_read(Coproc* coproc, char* line, size_t size);
+long coproc_timeout(Coproc* coproc);
+void coproc_kill_on_exit(Coproc* coprocs, size_t num_coprocs);
+
+#endif // COPROC_HEADER_TCHEV
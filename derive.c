@@ -0,0 +1,105 @@
+#include "derive.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+/*
+ * Derived blocks have no listener and read no sensor: the renderer computes them from the
+ * values published by their inputs, before rendering a frame. A derived block is only
+ * computed again when the sequence of one of its inputs moved, and the derived blocks are
+ * sorted so that a block using another derived block sees its value of the same frame.
+ * A derived block is stale while one of its inputs is, instead of showing a fresh value
+ * computed from an old one.
+ */
+
+/*
+ * Sort the derived blocks so that each one comes after the derived blocks it uses.
+ * Returns the number of blocks kept, the blocks of a dependency cycle are dropped.
+ */
+int derive_sort(Derived* derived, size_t num_derived)
+{
+    if(num_derived == 0){
+        return 0;
+    }
+
+    Derived sorted[num_derived];
+    int placed[num_derived];
+    memset(placed, 0, sizeof(placed));
+
+    size_t num_sorted = 0;
+    int progress = 1;
+    while(progress){
+        progress = 0;
+        for(size_t i=0; i < num_derived; ++i){
+            if(placed[i]){
+                continue;
+            }
+
+            // Ready once every input produced by a derived block is placed
+            int ready = 1;
+            for(size_t j=0; j < derived[i].num_inputs && ready; ++j){
+                for(size_t k=0; k < num_derived && ready; ++k){
+                    ready = derived[k].blk != derived[i].inputs[j] || placed[k];
+                }
+            }
+            if(ready){
+                sorted[num_sorted++] = derived[i];
+                placed[i] = 1;
+                progress = 1;
+            }
+        }
+    }
+
+    for(size_t i=0; i < num_derived; ++i){
+        if(!placed[i]){
+            fprintf(stderr, "derive: block %s is in or depends on a dependency cycle\n", derived[i].blk->name);
+        }
+    }
+    memcpy(derived, sorted, num_sorted * sizeof(Derived));
+    return num_sorted;
+}
+
+/* Compute the derived blocks whose inputs changed, returns the number of blocks published */
+int derive_update(Derived* derived, size_t num_derived)
+{
+    int published = 0;
+    for(size_t i=0; i < num_derived; ++i){
+        Derived* d = &derived[i];
+
+        int changed = 0;
+        int stale = 0;
+        unsigned int seq[DERIVE_INPUTS];
+        double values[DERIVE_INPUTS];
+        for(size_t j=0; j < d->num_inputs; ++j){
+            // The sequence is read before the value: a newer value is computed again at the next frame
+            seq[j] = block_sequence(d->inputs[j]);
+            values[j] = block_value(d->inputs[j]);
+            stale |= block_stale(d->inputs[j]);
+            changed |= seq[j] != d->seen[j];
+        }
+        if(!changed){
+            continue;
+        }
+        memcpy(d->seen, seq, sizeof(seq));
+
+        // The input publishing again also moves its sequence, the block is computed then
+        if(stale){
+            if(!block_stale(d->blk)){
+                block_set_stale(d->blk);
+                trace_event(TRACE_STALE, d->blk->id);
+                published += 1;
+            }
+            continue;
+        }
+
+        trace_event(TRACE_CALLBACK_START, d->blk->id);
+        d->compute(d->blk, values);
+        trace_event(TRACE_CALLBACK_END, d->blk->id);
+        block_publish(d->blk);
+        trace_event(TRACE_PUBLISH, d->blk->id);
+        published += 1;
+    }
+    return published;
+}
@@ -0,0 +1,22 @@
+#ifndef DERIVE_HEADER_TCHEV
+#define DERIVE_HEADER_TCHEV
+
+#include <stddef.h>
+
+#include "block.h"
+
+#define DERIVE_INPUTS 4
+
+/* A block computed from the raw values of other blocks, possibly derived themselves */
+typedef struct {
+    Block* blk;
+    Block* inputs[DERIVE_INPUTS];
+    size_t num_inputs;
+    void (*compute)(Block* blk, const double* inputs);  // pure, fills blk->data from the input values
+    unsigned int seen[DERIVE_INPUTS];                     // sequence of each input at the last computation
+} Derived;
+
+int derive_sort(Derived* derived, size_t num_derived);
+int derive_update(Derived* derived, size_t num_derived);
+
+#endif // DERIVE_HEADER_TCHEV
@@ -3,20 +3,35 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <errno.h>
+#include <stdint.h>
 
 #include <time.h>
 
 #include <sys/inotify.h>
 #include <sys/sysinfo.h>
+#include <sys/eventfd.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <poll.h>
 
 #include <X11/Xlib.h>
+#include <X11/XKBlib.h>
 
 #include "debug.h"
 #include "block.h"
 #include "utils.h"
 #include "listeners.h"
+#include "sampler.h"
+#include "procscan.h"
+#include "coproc.h"
+#include "policy.h"
+#include "derive.h"
+#include "shm.h"
+#include "trace.h"
 
 
 /* defines */
@@ -31,9 +46,13 @@ void battery_callback      (Block* blk);
 void power_callback        (Block* blk);
 void temperature_callback  (Block* blk);
 void fan_callback          (Block* blk);
+void top_callback          (Block* blk);
 void mem_callback          (Block* blk);
+void disk_callback         (Block* blk);
+void disk_mounts_callback  (Block* blk);
 void brightness_callback   (Block* blk);
 void keyboard_callback     (Block* blk);
+void remaining_compute     (Block* blk, const double* inputs);
 
 void *listener_time        (void*);
 void *listener_volume      (void*);
@@ -41,11 +60,18 @@ void *listener_battery     (void*);
 void *listener_power       (void*);
 void *listener_temperature (void*);
 void *listener_fan         (void*);
+void *listener_top         (void*);
 void *listener_mem         (void*);
+void *listener_disk        (void*);
 void *listener_brightness  (void*);
-void *listener_keyboard    (void*);
 
 void detect_sensors(void);
+void keyboard_init(void);
+void keyboard_names(void);
+int  handle_xevents(void);
+void scripts_init(void);
+void derived_init(void);
+int  handle_script(size_t i);
 
 
 /* global variables */
@@ -53,22 +79,41 @@ void detect_sensors(void);
 static Display *dpy;
 
 static Block blocks[] = {
-    BLOCK_DEF(listener_keyboard),
-    BLOCK_DEF(listener_temperature),
-    BLOCK_DEF(listener_fan),
-    BLOCK_DEF(listener_mem),
-    BLOCK_DEF(listener_battery),
-    BLOCK_DEF(listener_power),
-    BLOCK_DEF(listener_brightness),
-    BLOCK_DEF(listener_volume),
-    BLOCK_DEF(listener_time),
+    BLOCK_DEF("keyboard", NULL),  // updated from the XKB events of the main loop
+    BLOCK_DEF("temperature", listener_temperature),
+    BLOCK_DEF("fan", listener_fan),
+    BLOCK_DEF("top", listener_top),
+    BLOCK_DEF("mem", listener_mem),
+    BLOCK_DEF("disk", listener_disk),
+    BLOCK_DEF("battery", listener_battery),
+    BLOCK_DEF("power", listener_power),
+    BLOCK_DEF("remaining", NULL), // derived from battery and power, see derived_defs
+    BLOCK_DEF("brightness", listener_brightness),
+    BLOCK_DEF("vpn", NULL),       // updated by its script, see scripts
+    BLOCK_DEF("volume", listener_volume),
+    BLOCK_DEF("time", listener_time),
 };
 
-static pthread_mutex_t mutex_cond = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t update_cond = PTHREAD_COND_INITIALIZER;
+static int update_fd = -1;  // eventfd written by the listeners after each publication
+
+static Block* keyboard_block = &blocks[0];
+static Block* temperature_block = NULL;   // looked up by name at startup
+static int xkb_event_base = -1;                       // -1 when the XKB extension is not available
+static int keyboard_group = 0;                        // active XKB group
+static char* keyboard_layouts[XkbNumKbdGroups];       // layout name of each XKB group
 
 
 static const char* bar_color = "#282828";
+static char* stale_color = "#665c54";    // color of blocks whose sensor missed its deadline
+static const long slow_deadline = 200;   // ms allowed to slow sensors (fan, battery) for one read
+static const long startup_deadline = 50; // ms waited for the first sample of every block before the first frame
+static const int export_shm = 1;         // export the blocks in shared memory, see shm.h
+static const time_t battery_interval_factor = 3;      // periodic blocks are refreshed 3 times less often on battery
+static const long battery_timer_slack = 500000000;    // ns the timers of the listeners may be delayed by on battery
+
+static const char* record_dir = NULL;    // directory of the recorded time series, e.g. "dwmbar" for ~/.local/share/dwmbar, NULL to disable the recorder
+static const uint32_t record_capacity = 1 << 16;  // records kept per block, 32 bytes each
+static const char* record_blocks[] = {"power", "temperature", "fan"};
 static char* fail_icon_s = " ";
 static char* fail_icon = "";
 
@@ -80,11 +125,92 @@ static char* bat_curr_sensor;    // "/sys/class/power_supply/BAT0/current_now"
 static char* bat_volt_sensor;    // "/sys/class/power_supply/BAT0/voltage_now"
 static char* bat_present_sensor; // "/sys/class/power_supply/BAT0/present"
 static char* bat_capa_sensor;    // "/sys/class/power_supply/BAT0/capacity"
+static double battery_full_energy = NAN;  // Wh stored by the full battery, read once from BAT0
 static char* mem_sensor;         // "/proc/meminfo"
+static int fan1_attr = -1;       // sampler attributes of the sensors above, -1 when missing
+static int fan2_attr = -1;
+static int cpu_attr = -1;
+static int bat_status_attr = -1;
+static int bat_curr_attr = -1;
+static int bat_volt_attr = -1;
+static int bat_present_attr = -1;
+static int bat_capa_attr = -1;
+static int backlight_fd = -1;     // "/sys/class/backlight/*/actual_brightness"
+static int backlight_max_fd = -1; // "/sys/class/backlight/*/max_brightness"
+static const long backlight_min_interval = 250;   // ms, backlight polling interval right after a change
+static const long backlight_max_interval = 5000;  // ms, backlight polling interval when idle
+
+/*
+ * PSI triggers waking the memory block, unprivileged triggers need a window multiple of 2s.
+ * The memory trigger fires at 200ms of stall per 2s window, the 10% of mem_pressure_threshold
+ */
+static const char* psi_triggers[][2] = {
+    {"/proc/pressure/memory", "some 200000 2000000"},
+    // {"/proc/pressure/cpu", "some 500000 2000000"},
+    // {"/proc/pressure/io",  "some 500000 2000000"},
+};
+static int psi_fds[LENGTH(psi_triggers)];
+static const time_t mem_idle_interval = 600;    // polling interval of the memory block when there is no pressure
+static const double mem_pressure_threshold = 10; // "some avg10" percentage above which the block is highlighted, keep the memory trigger in line
+
+static ProcScan top_scan;                           // incremental /proc walker of the top process block
+static const time_t top_interval = 10;              // refresh interval of the top process block
+static const time_t top_hot_interval = 2;           // refresh interval while the cpu is hot, to catch what spins the fans
+static const double top_hot_temperature = 60;       // °C above which the cpu is hot
+static const double top_min_cpu = 5;                // the block is hidden while no process uses more of one cpu, in %
+static const int top_show_rss = 0;                  // also show the resident memory of the top process
+
+static const char* disk_mounts[] = {"/", "/home"};  // mount points shown by the disk block
+static const time_t disk_statvfs_ttl = 60;          // free space changes slowly, refresh it every minute
+static int diskstats_fd = -1;                       // persistent fd on /proc/diskstats
+static int mountinfo_fd = -1;                       // persistent fd on /proc/self/mountinfo, POLLPRI on mount changes
+static dev_t disk_devs[LENGTH(disk_mounts)];        // device of each mount point, 0 when unknown
+static unsigned long long disk_free[LENGTH(disk_mounts)];
+static time_t disk_free_time[LENGTH(disk_mounts)];
+static unsigned long long disk_prev_read;           // sectors read at the previous sample
+static unsigned long long disk_prev_written;        // sectors written at the previous sample
+static struct timespec disk_prev_time;              // time of the previous sample, 0 to restart the deltas
 
-static const char* brightness_file = "/mnt/data/Programmation/Archlinux/Scripts/brightness_control/current";
 static const char* volume_file = "/mnt/data/Programmation/Archlinux/Scripts/volume_control/current";
-static const char* keyboard_file = "/mnt/data/Programmation/Archlinux/Scripts/keyboard_control/current";
+
+/*
+ * Blocks fed by a long-lived script run with "sh -c", which prints one line per update.
+ * The line is the text of the block, an empty line hides the block.
+ */
+typedef struct {
+    const char* block;    // name of the block in blocks
+    const char* icon;
+    const char* color;
+    const char* command;
+} Script;
+
+static const Script scripts[] = {
+    // Name of the first VPN interface up (IFF_UP set, their operstate stays unknown), printed again
+    // on every link change. Without iproute2 the block stays empty instead of restarting in a loop
+    {"vpn", "", "#8fbcbb",
+     "vpn() { for i in wg0 tun0; do f=$(cat /sys/class/net/$i/flags 2>/dev/null) && [ $((f & 1)) = 1 ] "
+     "&& { echo $i; return; }; done; echo; }; "
+     "vpn; command -v ip >/dev/null || exec sleep 2147483647; ip monitor link | while read -r _; do vpn; done"},
+};
+static Coproc coprocs[LENGTH(scripts)];
+static Block* script_blocks[LENGTH(scripts)];
+
+/*
+ * Blocks computed by the renderer from the raw values of other blocks, without reading any sensor.
+ * compute receives the values of the inputs in order, NAN for an input without value, and is
+ * only called when one of them changed.
+ */
+typedef struct {
+    const char* block;                   // name of the block in blocks
+    const char* inputs[DERIVE_INPUTS];   // names of the input blocks, derived blocks are allowed
+    void (*compute)(Block* blk, const double* inputs);
+} DerivedDef;
+
+static const DerivedDef derived_defs[] = {
+    {"remaining", {"battery", "power"}, remaining_compute},
+};
+static Derived derived[LENGTH(derived_defs)];
+static size_t num_derived = 0;
 
 /* function implementations */
 
@@ -92,6 +218,7 @@ void time_callback(Block* blk)
 {
     blk->data.color = "#ffffff";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     unsigned int hour = -1;
 
@@ -106,6 +233,7 @@ void time_callback(Block* blk)
             blk->data.text = smprintf(fail_icon_s);
         }else{
             blk->data.text = smprintf("%s", buf);
+            blk->data.value = now;
             hour = timtm->tm_hour;
         }
     }
@@ -130,6 +258,7 @@ void volume_callback(Block* blk)
 {
     blk->data.color = "#ebcb8b";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     /* Read current volume */
     debug_printf("reading %s\n", volume_file);
@@ -146,6 +275,7 @@ void volume_callback(Block* blk)
         free(content);
 
         blk->data.text = smprintf("%d%%", vol);
+        blk->data.value = vol;
         if(vol == 0){
             blk->data.icon = "ﱝ";
         }else if(vol < 25){
@@ -167,10 +297,11 @@ void battery_callback(Block* blk)
 {
     blk->data.color = "#a3be8c";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     int cap = -1;
 
-    char* bat_present = read_file(bat_present_sensor);
+    char* bat_present = sampler_read(bat_present_attr);
     if (bat_present == NULL){
         blk->data.text = smprintf(fail_icon_s);
     }
@@ -178,12 +309,13 @@ void battery_callback(Block* blk)
         blk->data.text = smprintf("");
     }
     else{
-        char* bat_capa = read_file(bat_capa_sensor);
+        char* bat_capa = sampler_read(bat_capa_attr);
         if (bat_capa == NULL) {
             blk->data.text = smprintf(fail_icon_s);
         }else{
             cap = atoi(bat_capa);
             blk->data.text = smprintf("%d%%", cap);
+            blk->data.value = cap;
         }
         free(bat_capa);
     }
@@ -207,6 +339,7 @@ void power_callback(Block* blk)
     blk->data.icon = "";
     blk->data.color = "#d06c4c";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     /* circular buffer */
     static float history[5];
@@ -215,15 +348,21 @@ void power_callback(Block* blk)
 
     long int current = 0;
     long int voltage = 0;
+    int discharging = 0;
 
     /* Hide the block if battery full */
-    char* bat_status = read_file(bat_status_sensor);
+    char* bat_status = sampler_read(bat_status_attr);
     if(bat_status == NULL){
+        policy_set_battery(0);
         blk->data.text = smprintf(fail_icon);
         return;
     }else{
         char* stripped = strip(bat_status);
 
+        // The periodic blocks slow down while discharging
+        discharging = !strcmp(stripped, "Discharging");
+        policy_set_battery(discharging);
+
         // Hide the indicator if battery is full
         if(!strcmp(stripped, "Full")){
             blk->data.icon = "";
@@ -238,7 +377,7 @@ void power_callback(Block* blk)
     }
     
 
-    char* bat_curr = read_file(bat_curr_sensor);
+    char* bat_curr = sampler_read(bat_curr_attr);
     if (bat_curr == NULL){
         blk->data.text = smprintf(fail_icon);
         return;
@@ -247,7 +386,7 @@ void power_callback(Block* blk)
         free(bat_curr);
     }
 
-    char* bat_volt = read_file(bat_volt_sensor);
+    char* bat_volt = sampler_read(bat_volt_attr);
     if (bat_volt == NULL){
         blk->data.text = smprintf(fail_icon);
         return;
@@ -275,7 +414,9 @@ void power_callback(Block* blk)
         }
         sum /= len;
 
+        // The value is signed, drawn from the battery is positive and charging is negative
         blk->data.text = smprintf("%.1fW", sum);
+        blk->data.value = discharging ? sum : -sum;
     }
 }
 
@@ -284,15 +425,17 @@ void temperature_callback(Block* blk)
 {
     blk->data.color = "#e85c6a";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     double temp = 0;
     
-    char* cpu_temp = read_file(cpu_sensor);
+    char* cpu_temp = sampler_read(cpu_attr);
     if (cpu_temp == NULL){
         blk->data.text = smprintf(fail_icon);
     } else{
         temp = atof(cpu_temp)/1000;
         blk->data.text = smprintf("%02.0f°C", temp);
+        blk->data.value = temp;
     }
     free(cpu_temp);
 
@@ -310,13 +453,14 @@ void fan_callback(Block* blk)
 {
     blk->data.color = "#88c0d0";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     char* rpm1;
     char* rpm2;
     int rpm1_i = -1;
     int rpm2_i = -1;
 
-    char* fan1 = read_file(fan1_sensor);
+    char* fan1 = sampler_read(fan1_attr);
     if (fan1 == NULL){
         rpm1 = smprintf(fail_icon_s);
     }else{
@@ -325,7 +469,7 @@ void fan_callback(Block* blk)
         rpm1 = smprintf("%d", rpm1_i);
     }
 
-    char* fan2 = read_file(fan2_sensor);
+    char* fan2 = sampler_read(fan2_attr);
     if (fan2 == NULL){
         rpm2 = smprintf(fail_icon_s);
     }else{
@@ -337,6 +481,7 @@ void fan_callback(Block* blk)
     if(rpm1_i == -1 && rpm2_i == -1){
         blk->data.text = smprintf("%s %s", rpm1, rpm2);
     }else{
+        blk->data.value = rpm1_i > rpm2_i ? rpm1_i : rpm2_i;
         if(rpm1_i == 0 && rpm2_i == 0){
             blk->data.text = smprintf(" ");
         }else{
@@ -355,17 +500,54 @@ void fan_callback(Block* blk)
 
 }
 
+/* Format a number of bytes with a binary unit suffix */
+static char* human_bytes(double bytes)
+{
+    const char* units = "BKMGT";
+    while(bytes >= 1024 && units[1]){
+        bytes /= 1024;
+        units++;
+    }
+    return smprintf(bytes < 10 && *units != 'B' ? "%.1f%c" : "%.0f%c", bytes, *units);
+}
+
+void top_callback(Block* blk)
+{
+    blk->data.icon = "";
+    blk->data.color = "#d08770";
+    free(blk->data.text);
+    blk->data.value = NAN;
+
+    // Without /proc the block stays empty
+    ProcTop top;
+    if(top_scan.dir == NULL || procscan_update(&top_scan, &top) == -1 || top.cpu < top_min_cpu){
+        blk->data.icon = "";
+        blk->data.text = smprintf("");
+        return;
+    }
+
+    blk->data.value = top.cpu;
+    if(top_show_rss){
+        char* rss = human_bytes(top.rss);
+        blk->data.text = smprintf("%s %.0f%% %s", top.comm, top.cpu, rss);
+        free(rss);
+    }else{
+        blk->data.text = smprintf("%s %.0f%%", top.comm, top.cpu);
+    }
+}
+
 void mem_callback(Block* blk)
 {
     blk->data.icon = "";
     blk->data.color = "#ebcb8b";
     free(blk->data.text);
+    blk->data.value = NAN;
 
     // Manually opening file here because it doesn't pass the checks of the read_file function,
     // and it is easier for parsing lines
-    FILE *meminfo = fopen("/proc/meminfo", "r");
+    FILE *meminfo = fopen(mem_sensor, "r");
     if(meminfo == NULL){
-        debug_printf("[mem_callback]: cannot open /proc/meminfo file\n");
+        debug_printf("[mem_callback]: cannot open %s file\n", mem_sensor);
         blk->data.text = smprintf(fail_icon_s);
         return;
     }
@@ -387,12 +569,25 @@ void mem_callback(Block* blk)
     fclose(meminfo);
 
     if(ram_available < 0 || ram_total < 0){
-        debug_printf("[mem_callback]: no MemTotal or MemAvailable entry in /proc/meminfo\n");
+        debug_printf("[mem_callback]: no MemTotal or MemAvailable entry in %s\n", mem_sensor);
         blk->data.text = smprintf(fail_icon_s);
         return;
     }
 
+    // Highlight the block while tasks are stalled on memory
+    char pressure[256];
+    double avg10 = 0;
+    ssize_t len = psi_fds[0] == -1 ? -1 : pread(psi_fds[0], pressure, sizeof(pressure) - 1, 0);
+    if(len > 0){
+        pressure[len] = 0;
+        sscanf(pressure, "some avg10=%lf", &avg10);
+    }
+    if(avg10 >= mem_pressure_threshold){
+        blk->data.color = "#bf616a";
+    }
+
     unsigned int ram_used = (ram_total - ram_available) / 1024; // kB -> MB
+    blk->data.value = ram_used;
 
     if(ram_used > 1024){
         double used_f = ram_used / 1024.;
@@ -403,27 +598,160 @@ void mem_callback(Block* blk)
     
 }
 
+/* Read a whole procfs file through a persistent fd, returns the length read or -1 */
+static ssize_t pread_all(int fd, char* buf, size_t size)
+{
+    size_t len = 0;
+    ssize_t ret;
+    while(len < size - 1 && (ret = pread(fd, buf + len, size - 1 - len, len)) > 0){
+        len += ret;
+    }
+    if(len == 0){
+        return -1;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+void disk_callback(Block* blk)
+{
+    blk->data.icon = "";
+    blk->data.color = "#b48ead";
+    free(blk->data.text);
+    blk->data.value = NAN;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Single pass over /proc/diskstats, only the lines of the configured devices are parsed
+    static char stats[32768];
+    unsigned long long sectors_read = 0;
+    unsigned long long sectors_written = 0;
+    if(pread_all(diskstats_fd, stats, sizeof(stats)) == -1){
+        debug_printf("[disk_callback]: cannot read diskstats\n");
+        blk->data.text = smprintf(fail_icon_s);
+        return;
+    }
+
+    char* line = stats;
+    while(line && *line){
+        char* end;
+        unsigned int maj = strtoul(line, &end, 10);
+        unsigned int min = strtoul(end, &end, 10);
+        const dev_t dev = makedev(maj, min);
+
+        int wanted = 0;
+        for(size_t i=0; i < LENGTH(disk_devs) && !wanted; ++i){
+            wanted = disk_devs[i] != 0 && disk_devs[i] == dev;
+        }
+
+        unsigned long long rd = 0, wr = 0;
+        if(wanted && sscanf(end, " %*s %*u %*u %llu %*u %*u %*u %llu", &rd, &wr) == 2){
+            sectors_read += rd;
+            sectors_written += wr;
+        }
+
+        line = strchr(line, '\n');
+        if(line){
+            line++;
+        }
+    }
+
+    // Throughput since the previous sample, diskstats counts 512-byte sectors
+    double read_rate = 0;
+    double write_rate = 0;
+    const double elapsed = (now.tv_sec - disk_prev_time.tv_sec) + (now.tv_nsec - disk_prev_time.tv_nsec) / 1e9;
+    if(disk_prev_time.tv_sec != 0 && elapsed > 0 && sectors_read >= disk_prev_read && sectors_written >= disk_prev_written){
+        read_rate = (sectors_read - disk_prev_read) * 512 / elapsed;
+        write_rate = (sectors_written - disk_prev_written) * 512 / elapsed;
+    }
+    disk_prev_read = sectors_read;
+    disk_prev_written = sectors_written;
+    disk_prev_time = now;
+
+    // Free space, cached for disk_statvfs_ttl seconds
+    char* free_text = smprintf("");
+    for(size_t i=0; i < LENGTH(disk_mounts); ++i){
+        if(now.tv_sec - disk_free_time[i] >= disk_statvfs_ttl || disk_free_time[i] == 0){
+            struct statvfs vfs;
+            char* mount = root_path(disk_mounts[i]);
+            if(statvfs(mount, &vfs) == 0){
+                disk_free[i] = (unsigned long long)vfs.f_bavail * vfs.f_frsize;
+                disk_free_time[i] = now.tv_sec;
+            }
+            free(mount);
+        }
+
+        char* size = human_bytes(disk_free[i]);
+        char* joined = smprintf("%s %s", free_text, size);
+        free(size);
+        free(free_text);
+        free_text = joined;
+    }
+
+    char* rd = human_bytes(read_rate);
+    char* wr = human_bytes(write_rate);
+    blk->data.text = smprintf("%s %s%s", rd, wr, free_text);
+    blk->data.value = read_rate + write_rate;
+    free(rd);
+    free(wr);
+    free(free_text);
+}
+
+/* Called when mountinfo reports a change: resolve the device of each mount point again */
+void disk_mounts_callback(Block* blk)
+{
+    static char mountinfo[65536];
+    for(size_t i=0; i < LENGTH(disk_devs); ++i){
+        disk_devs[i] = 0;
+        disk_free_time[i] = 0;
+    }
+
+    if(pread_all(mountinfo_fd, mountinfo, sizeof(mountinfo)) != -1){
+        // "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw"
+        char* saveptr;
+        for(char* line = strtok_r(mountinfo, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)){
+            unsigned int maj, min;
+            char mount[4096];
+            if(sscanf(line, "%*d %*d %u:%u %*s %4095s", &maj, &min, mount) != 3){
+                continue;
+            }
+            for(size_t i=0; i < LENGTH(disk_mounts); ++i){
+                if(strcmp(mount, disk_mounts[i]) == 0){
+                    disk_devs[i] = makedev(maj, min);
+                }
+            }
+        }
+    }
+
+    // Avoid counting the sectors of a newly added device as throughput
+    disk_prev_time.tv_sec = 0;
+    disk_callback(blk);
+}
+
 void brightness_callback(Block* blk)
 {
     blk->data.color = "#88c0d0";
     blk->data.icon = "☀";
     free(blk->data.text);
+    blk->data.value = NAN;
 
-    char* brightness = read_file(brightness_file);
-    if(brightness == NULL){
-        fprintf(stderr, "Cannot read %s\n", brightness_file);
+    char actual[32];
+    char max[32];
+    if(pread_all(backlight_fd, actual, sizeof(actual)) == -1 || pread_all(backlight_max_fd, max, sizeof(max)) == -1){
+        debug_printf("[brightness_callback]: no backlight\n");
         blk->data.text = NULL;
         return;
     }
 
-    if(is_num(brightness)){
-        float bright = atoi(brightness);
-        int percentage = round(bright/1200);
-        blk->data.text = smprintf("%d%%", percentage);
-    }else{
-        blk->data.text = strip(brightness);
+    const long max_brightness = atol(max);
+    if(max_brightness <= 0){
+        blk->data.text = smprintf(fail_icon_s);
+        return;
     }
-    free(brightness);
+    const int percentage = round(atol(actual) * 100. / max_brightness);
+    blk->data.text = smprintf("%d%%", percentage);
+    blk->data.value = percentage;
 }
 
 void keyboard_callback(Block* blk)
@@ -431,153 +759,598 @@ void keyboard_callback(Block* blk)
     blk->data.color = "#8cbea2";
     blk->data.icon = "K";
     free(blk->data.text);
+    blk->data.value = NAN;
 
-    char* layout = read_file(keyboard_file);
-    if(layout == NULL){
-        fprintf(stderr, "Cannot read %s\n", keyboard_file);
+    if(keyboard_group < 0 || keyboard_group >= XkbNumKbdGroups || keyboard_layouts[keyboard_group] == NULL){
         blk->data.text = NULL;
         return;
     }
+    blk->data.text = smprintf("%s", keyboard_layouts[keyboard_group]);
+    blk->data.value = keyboard_group;
+}
+
+void remaining_compute(Block* blk, const double* inputs)
+{
+    const double capacity = inputs[0];  // %
+    const double power = inputs[1];     // W, averaged by the power block, negative while charging
+
+    blk->data.icon = "";
+    blk->data.color = "#a3be8c";
+    free(blk->data.text);
+    blk->data.value = NAN;
+
+    // A charging power says nothing of the time to empty
+    if(isnan(capacity) || isnan(power) || power <= 0 || isnan(battery_full_energy)){
+        blk->data.icon = "";
+        blk->data.text = smprintf("");
+        return;
+    }
 
-    blk->data.text = strip(layout);
-    free(layout);
+    const double hours = capacity / 100 * battery_full_energy / power;
+    blk->data.text = smprintf("%d:%02d", (int)hours, (int)(hours * 60) % 60);
+    blk->data.value = hours;
 }
 
 void* listener_time(void* p_data)
 {   
     Block* blk = (Block*)p_data;
-    safe_callback(blk, time_callback, &update_cond);
-    aligned_time_listener(1592384460, 60, blk, time_callback, &update_cond);
+    safe_callback(blk, time_callback, update_fd);
+    aligned_time_listener(1592384460, 60, blk, time_callback, update_fd);
     return (void*)0;
 }
 
 void *listener_volume(void* p_data)
 {
     Block* blk = (Block*)p_data;
-    safe_callback(blk, volume_callback, &update_cond);
-    file_listener(blk, volume_file, volume_callback, &update_cond);
+    safe_callback(blk, volume_callback, update_fd);
+    file_listener(blk, volume_file, volume_callback, update_fd);
     return (void*)0;
 }
 
 void *listener_battery(void* p_data)
 {
     Block* blk = (Block*)p_data;
-    safe_callback(blk, battery_callback, &update_cond);
-    time_listener(60, blk, battery_callback, &update_cond);
+    const int attrs[] = {bat_present_attr, bat_capa_attr};
+    if(sampler_add(blk, 60, slow_deadline, attrs, LENGTH(attrs), battery_callback, update_fd) == 0){
+        return (void*)0;
+    }
+    slow_time_listener(60, slow_deadline, blk, battery_callback, update_fd);
     return (void*)0;
 }
 
 void *listener_power(void* p_data)
 {
     Block* blk = (Block*)p_data;
-    safe_callback(blk, power_callback, &update_cond);
-    time_listener(20, blk, power_callback, &update_cond);
+    const int attrs[] = {bat_status_attr, bat_curr_attr, bat_volt_attr};
+    if(sampler_add(blk, 20, slow_deadline, attrs, LENGTH(attrs), power_callback, update_fd) == 0){
+        return (void*)0;
+    }
+    slow_time_listener(20, slow_deadline, blk, power_callback, update_fd);
     return (void*)0;
 }
 
 void *listener_temperature(void* p_data)
 {   
     Block* blk = (Block*)p_data;
-    safe_callback(blk, temperature_callback, &update_cond);
-    time_listener(20, blk, temperature_callback, &update_cond);
+
+    char* hwmon = root_path("/sys/class/hwmon");
+    cpu_sensor = find_sensor(hwmon, "coretemp", "temp1_input");
+    debug_printf("cpu_sensor: %s\n", cpu_sensor);
+    free(hwmon);
+
+    cpu_attr = sampler_attr(cpu_sensor);
+    if(sampler_add(blk, 20, slow_deadline, &cpu_attr, 1, temperature_callback, update_fd) == 0){
+        return (void*)0;
+    }
+    safe_callback(blk, temperature_callback, update_fd);
+    time_listener(20, blk, temperature_callback, update_fd);
     return (void*)0;
 }
 
 void *listener_fan(void* p_data)
 {   
     Block* blk = (Block*)p_data;
-    safe_callback(blk, fan_callback, &update_cond);
-    time_listener(5, blk, fan_callback, &update_cond);
+
+    char* hwmon = root_path("/sys/class/hwmon");
+    fan1_sensor = find_sensor(hwmon, "dell_smm", "fan1_input");
+    fan2_sensor = find_sensor(hwmon, "dell_smm", "fan2_input");
+    debug_printf("fan1_sensor: %s\n", fan1_sensor);
+    debug_printf("fan2_sensor: %s\n", fan2_sensor);
+    free(hwmon);
+
+    fan1_attr = sampler_attr(fan1_sensor);
+    fan2_attr = sampler_attr(fan2_sensor);
+    const int attrs[] = {fan1_attr, fan2_attr};
+    if(sampler_add(blk, 5, slow_deadline, attrs, LENGTH(attrs), fan_callback, update_fd) == 0){
+        return (void*)0;
+    }
+    slow_time_listener(5, slow_deadline, blk, fan_callback, update_fd);
     return (void*)0;
 }
 
-void *listener_mem(void* p_data)
-{   
+/* Block of the bar named name, NULL if there is none */
+static Block* find_block(const char* name)
+{
+    for(int i=0; i < LENGTH(blocks); ++i){
+        if(strcmp(blocks[i].name, name) == 0){
+            return &blocks[i];
+        }
+    }
+    return NULL;
+}
+
+/* Sample the processes more often while the cpu is hot */
+static time_t top_next_interval(Block* blk)
+{
+    const double temp = temperature_block ? block_value(temperature_block) : NAN;
+    return !isnan(temp) && temp >= top_hot_temperature ? top_hot_interval : top_interval;
+}
+
+void *listener_top(void* p_data)
+{
     Block* blk = (Block*)p_data;
-    safe_callback(blk, mem_callback, &update_cond);
-    time_listener(10, blk, mem_callback, &update_cond);
+
+    char* proc = root_path("/proc");
+    const int ok = procscan_init(&top_scan, proc) == 0;
+    free(proc);
+    if(!ok){
+        safe_callback(blk, top_callback, update_fd);
+        return (void*)0;
+    }
+
+    // The first scan only sets the baseline of the cpu times
+    safe_callback(blk, top_callback, update_fd);
+    adaptive_time_listener(top_next_interval, blk, top_callback, update_fd);
     return (void*)0;
 }
 
-void *listener_brightness(void* p_data)
+void *listener_mem(void* p_data)
 {   
     Block* blk = (Block*)p_data;
-    safe_callback(blk, brightness_callback, &update_cond);
-    file_listener(blk, brightness_file, brightness_callback, &update_cond);
+
+    // Wait for memory pressure events, and fall back to polling when PSI is not available
+    int psi_available = 1;
+    for(size_t i=0; i < LENGTH(psi_triggers); ++i){
+        char* path = root_path(psi_triggers[i][0]);
+        psi_fds[i] = psi_open(path, psi_triggers[i][1]);
+        psi_available = psi_available && psi_fds[i] != -1;
+        free(path);
+    }
+
+    safe_callback(blk, mem_callback, update_fd);
+    if(psi_available){
+        psi_listener(psi_fds, LENGTH(psi_fds), 10, mem_idle_interval, blk, mem_callback, update_fd);
+    }
+    time_listener(10, blk, mem_callback, update_fd);
     return (void*)0;
 }
 
-void *listener_keyboard(void *p_data)
+void *listener_disk(void* p_data)
 {
     Block* blk = (Block*)p_data;
-    safe_callback(blk, keyboard_callback, &update_cond);
-    file_listener(blk, keyboard_file, keyboard_callback, &update_cond);
+    safe_callback(blk, disk_mounts_callback, update_fd);
+    poll_listener(mountinfo_fd, 5, blk, disk_mounts_callback, disk_callback, update_fd);
+    return (void*)0;
+}
+
+void *listener_brightness(void* p_data)
+{   
+    Block* blk = (Block*)p_data;
+
+    char* backlights = root_path("/sys/class/backlight");
+    char* backlight = find_subdir(backlights);
+    if(backlight){
+        char* actual = smprintf("%s/actual_brightness", backlight);
+        char* max = smprintf("%s/max_brightness", backlight);
+        backlight_fd = open(actual, O_RDONLY | O_CLOEXEC);
+        backlight_max_fd = open(max, O_RDONLY | O_CLOEXEC);
+        free(actual);
+        free(max);
+    }
+    debug_printf("backlight: %s\n", backlight);
+    free(backlight);
+    free(backlights);
+
+    if(backlight_fd == -1){
+        safe_callback(blk, brightness_callback, update_fd);
+        return (void*)0;
+    }
+    sysfs_listener(backlight_fd, backlight_min_interval, backlight_max_interval, blk, brightness_callback, update_fd);
     return (void*)0;
 }
 
 
+/* Energy of the full battery in Wh, from energy_full or else charge_full * voltage_min_design, NAN if unknown */
+static double read_battery_full_energy(void)
+{
+    static const char* files[] = {"energy_full", "charge_full", "voltage_min_design"};  // uWh, uAh, uV
+    double values[LENGTH(files)];
+    for(size_t i=0; i < LENGTH(files); ++i){
+        char* name = smprintf("/sys/class/power_supply/BAT0/%s", files[i]);
+        char* path = root_path(name);
+        char* content = access(path, R_OK) == 0 ? read_file(path) : NULL;
+        values[i] = content ? strtod(content, NULL) : NAN;
+        free(content);
+        free(path);
+        free(name);
+    }
+
+    if(values[0] > 0){
+        return values[0] / 1e6;
+    }
+    if(values[1] > 0 && values[2] > 0){
+        return values[1] / 1e6 * values[2] / 1e6;
+    }
+    return NAN;
+}
+
+/* Sensors found by walking sysfs are looked up by their listener, so that the searches run in parallel */
 void detect_sensors(void)
 {
-    fan1_sensor         = find_sensor("/sys/class/hwmon", "dell_smm", "fan1_input");
-    fan2_sensor         = find_sensor("/sys/class/hwmon", "dell_smm", "fan2_input");
-    cpu_sensor          = find_sensor("/sys/class/hwmon", "coretemp", "temp1_input");
+    bat_status_sensor   = root_path("/sys/class/power_supply/BAT0/status");
+    bat_curr_sensor     = root_path("/sys/class/power_supply/BAT0/current_now");
+    bat_volt_sensor     = root_path("/sys/class/power_supply/BAT0/voltage_now");
+    bat_present_sensor  = root_path("/sys/class/power_supply/BAT0/present");
+    bat_capa_sensor     = root_path("/sys/class/power_supply/BAT0/capacity");
+    mem_sensor          = root_path("/proc/meminfo");
+    bat_status_attr     = sampler_attr(bat_status_sensor);
+    bat_curr_attr       = sampler_attr(bat_curr_sensor);
+    bat_volt_attr       = sampler_attr(bat_volt_sensor);
+    bat_present_attr    = sampler_attr(bat_present_sensor);
+    bat_capa_attr       = sampler_attr(bat_capa_sensor);
+    battery_full_energy = read_battery_full_energy();
+
+    char* diskstats     = root_path("/proc/diskstats");
+    char* mountinfo     = root_path("/proc/self/mountinfo");
+    diskstats_fd        = open(diskstats, O_RDONLY | O_CLOEXEC);
+    mountinfo_fd        = open(mountinfo, O_RDONLY | O_CLOEXEC);
+    free(diskstats);
+    free(mountinfo);
+    volume_file         = root_path(volume_file);
+}
+
+/*
+ * Build the group -> layout table from the XKB group names ("English (US)", "French"), which the
+ * keymap sets for every group, so the symbols string and its options never have to be parsed.
+ */
+void keyboard_names(void)
+{
+    for(int i=0; i < XkbNumKbdGroups; ++i){
+        free(keyboard_layouts[i]);
+        keyboard_layouts[i] = NULL;
+    }
+
+    XkbDescPtr desc = XkbAllocKeyboard();
+    if(desc == NULL){
+        return;
+    }
+    if(XkbGetNames(dpy, XkbGroupNamesMask, desc) != Success || desc->names == NULL){
+        XkbFreeKeyboard(desc, 0, True);
+        return;
+    }
+
+    for(int i=0; i < XkbNumKbdGroups; ++i){
+        if(desc->names->groups[i] != None){
+            char* name = XGetAtomName(dpy, desc->names->groups[i]);
+            if(name){
+                keyboard_layouts[i] = smprintf("%s", name);
+                XFree(name);
+            }
+        }
+    }
+
+    XkbFreeKeyboard(desc, 0, True);
+}
+
+/* Subscribe to the XKB group changes on the display used for the status */
+void keyboard_init(void)
+{
+    int opcode, error_base;
+    int major = XkbMajorVersion;
+    int minor = XkbMinorVersion;
+    if(!XkbQueryExtension(dpy, &opcode, &xkb_event_base, &error_base, &major, &minor)){
+        fprintf(stderr, "dwmbar: no XKB extension, the keyboard layout is not shown\n");
+        xkb_event_base = -1;
+        return;
+    }
+
+    XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbStateNotify, XkbGroupStateMask, XkbGroupStateMask);
+    XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbNamesNotify, XkbGroupNamesMask, XkbGroupNamesMask);
+
+    XkbStateRec state;
+    if(XkbGetState(dpy, XkbUseCoreKbd, &state) == Success){
+        keyboard_group = state.group;
+    }
+    keyboard_names();
+
+    keyboard_callback(keyboard_block);
+    block_publish(keyboard_block);
+}
+
+/* Process the queued X events, returns 1 when a block changed */
+int handle_xevents(void)
+{
+    int changed = 0;
+    while(XPending(dpy)){
+        XEvent ev;
+        XNextEvent(dpy, &ev);
+        if(xkb_event_base == -1 || ev.type != xkb_event_base){
+            continue;
+        }
+
+        XkbEvent* xkb = (XkbEvent*)&ev;
+        if(xkb->any.xkb_type == XkbStateNotify){
+            keyboard_group = xkb->state.group;
+        }else if(xkb->any.xkb_type == XkbNamesNotify){
+            keyboard_names();
+        }else{
+            continue;
+        }
+
+        trace_event(TRACE_WAKE, keyboard_block->id);
+        trace_event(TRACE_CALLBACK_START, keyboard_block->id);
+        keyboard_callback(keyboard_block);
+        trace_event(TRACE_CALLBACK_END, keyboard_block->id);
+        block_publish(keyboard_block);
+        trace_event(TRACE_PUBLISH, keyboard_block->id);
+        changed = 1;
+    }
+    return changed;
+}
+
+void scripts_init(void)
+{
+    for(size_t i=0; i < LENGTH(scripts); ++i){
+        coproc_init(&coprocs[i], scripts[i].command);
+        script_blocks[i] = find_block(scripts[i].block);
+        if(script_blocks[i] == NULL){
+            fprintf(stderr, "dwmbar: no block named %s for script\n", scripts[i].block);
+        }
+    }
+}
+
+void derived_init(void)
+{
+    for(size_t i=0; i < LENGTH(derived_defs); ++i){
+        Derived* d = &derived[num_derived];
+        memset(d, 0, sizeof(*d));
+        d->compute = derived_defs[i].compute;
+
+        int missing = 0;
+        d->blk = find_block(derived_defs[i].block);
+        for(size_t k=0; k < DERIVE_INPUTS && derived_defs[i].inputs[k]; ++k){
+            d->inputs[k] = find_block(derived_defs[i].inputs[k]);
+            missing |= d->inputs[k] == NULL;
+            d->num_inputs += 1;
+        }
+
+        if(d->blk == NULL || missing){
+            fprintf(stderr, "dwmbar: unknown block in derived block %s\n", derived_defs[i].block);
+            continue;
+        }
+        num_derived += 1;
+    }
+    num_derived = derive_sort(derived, num_derived);
+}
+
+/* Read the output of a script and start it again when needed, returns 1 when its block changed */
+int handle_script(size_t i)
+{
+    Block* blk = script_blocks[i];
+    if(blk == NULL){
+        return 0;
+    }
+
+    char line[COPROC_LINE_LEN];
+    const int ret = coproc_read(&coprocs[i], line, sizeof(line));
+    coproc_start(&coprocs[i]);
+    if(ret == -1){
+        // Keep the last line, dimmed, until the script prints again
+        block_set_stale(blk);
+        trace_event(TRACE_STALE, blk->id);
+        return 1;
+    }
+    if(ret == 0){
+        return 0;
+    }
 
-    bat_status_sensor   = "/sys/class/power_supply/BAT0/status";
-    bat_curr_sensor     = "/sys/class/power_supply/BAT0/current_now";
-    bat_volt_sensor     = "/sys/class/power_supply/BAT0/voltage_now";
-    bat_present_sensor  = "/sys/class/power_supply/BAT0/present";
-    bat_capa_sensor     = "/sys/class/power_supply/BAT0/capacity";
-    mem_sensor          = "/proc/meminfo";
+    trace_event(TRACE_WAKE, blk->id);
+    trace_event(TRACE_CALLBACK_START, blk->id);
+    free(blk->data.text);
+    blk->data.text = smprintf("%s", line);
+    blk->data.icon = line[0] ? (char*)scripts[i].icon : "";
+    blk->data.color = (char*)scripts[i].color;
+
+    char* end;
+    blk->data.value = strtod(line, &end);
+    if(end == line || *end){
+        blk->data.value = NAN;
+    }
+    trace_event(TRACE_CALLBACK_END, blk->id);
+    block_publish(blk);
+    trace_event(TRACE_PUBLISH, blk->id);
+    return 1;
 }
 
 int main(void)
 {
-    // Initialize display
-    if (!(dpy = XOpenDisplay(NULL))) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Initialize display, or print the status on stdout when running headless
+    if (getenv("DWMBAR_HEADLESS") != NULL) {
+        dpy = NULL;
+    } else if (!(dpy = XOpenDisplay(NULL))) {
         fprintf(stderr, "dwmstatus: cannot open display.\n");
         return 1;
     }
 
+    // Listeners signal new data through this eventfd, consecutive signals are coalesced
+    update_fd = eventfd(0, EFD_CLOEXEC);
+    if(update_fd == -1){
+        perror("eventfd");
+        return 1;
+    }
+
     pthread_t threads[LENGTH(blocks)];
 
     debug_printf("detecting sensors\n");
     detect_sensors();
-    debug_printf("fan1_sensor: %s\n", fan1_sensor);
-    debug_printf("fan2_sensor: %s\n", fan2_sensor);
-    debug_printf("cpu_sensor: %s\n", cpu_sensor);
     debug_printf("bat_status_sensor: %s\n", bat_status_sensor);
     debug_printf("bat_curr_sensor: %s\n", bat_curr_sensor);
     debug_printf("bat_volt_sensor: %s\n", bat_volt_sensor);
     debug_printf("bat_present_sensor: %s\n", bat_present_sensor);
     debug_printf("bat_capa_sensor: %s\n\n", bat_capa_sensor);
 
-    // Launch blocks
+    const char* names[LENGTH(blocks)];
+    for(int i=0; i < LENGTH(blocks); ++i){
+        blocks[i].id = i;
+        names[i] = blocks[i].name;
+    }
+
+    // SIGUSR1 dumps the event traces, it is only delivered to the main thread
+    sigset_t sigusr1;
+    sigemptyset(&sigusr1);
+    sigaddset(&sigusr1, SIGUSR1);
+    trace_init(names, LENGTH(blocks));
+    pthread_sigmask(SIG_BLOCK, &sigusr1, NULL);
+
+    if(export_shm){
+        shm_export_open(LENGTH(blocks));
+    }
+    policy_init(battery_interval_factor, battery_timer_slack);
+
+    char* records = record_dir ? recorder_dir(record_dir) : NULL;
+    for(int i=0; records && i < LENGTH(blocks); ++i){
+        for(int j=0; j < LENGTH(record_blocks); ++j){
+            if(strcmp(blocks[i].name, record_blocks[j]) == 0){
+                blocks[i].recorder = recorder_open(records, blocks[i].name, blocks[i].id, record_capacity);
+            }
+        }
+    }
+    free(records);
+
+    if(dpy){
+        keyboard_init();
+    }
+
+    // Launch blocks, the ones without listener are updated by the main loop
+    temperature_block = find_block("temperature");
+
     debug_printf("creating %ld threads\n", LENGTH(blocks));
     for(int i=0; i < LENGTH(blocks); ++i){
-        pthread_create(&threads[i], NULL, blocks[i].listener, &blocks[i]);
+        if(blocks[i].listener){
+            pthread_create(&threads[i], NULL, blocks[i].listener, &blocks[i]);
+        }
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &sigusr1, NULL);
+
+    derived_init();
+
+    // The scripts are started by the main thread, which reads their output
+    scripts_init();
+    coproc_kill_on_exit(coprocs, LENGTH(coprocs));
+    for(size_t i=0; i < LENGTH(scripts); ++i){
+        coproc_start(&coprocs[i]);
+    }
+
+    // Wait on the listeners, on the X connection and on the scripts
+    struct pollfd pfds[2 + LENGTH(scripts)] = {
+        {.fd = update_fd, .events = POLLIN},
+        {.fd = dpy ? ConnectionNumber(dpy) : -1, .events = POLLIN},
+    };
+
+    // Wait for the first sample of every block, up to startup_deadline, to push a single complete first frame
+    size_t ready = 0;
+    size_t expected = 0;
+    long remaining = startup_deadline;
+    while(1){
+        ready = expected = 0;
+        for(int i=0; i < LENGTH(blocks); ++i){
+            expected += blocks[i].listener != NULL;
+            ready += blocks[i].listener != NULL && block_published(&blocks[i]);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = startup_deadline - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+        if(ready == expected || remaining <= 0){
+            break;
+        }
+
+        if(poll(pfds, 1, remaining) > 0){
+            uint64_t count;
+            if(read(update_fd, &count, sizeof(count)) == -1){
+                perror("read(update_fd)");
+            }
+        }
     }
+    int first_frame = 1;
+    notify_update(update_fd);
 
     // Update status
     while(1){
 
-        // wait for update
-        pthread_mutex_lock(&mutex_cond);
-        pthread_cond_wait (&update_cond, &mutex_cond);
+        // wait for update, Xlib may already have queued events while setting the status
+        long timeout = -1;
+        for(size_t i=0; i < LENGTH(scripts); ++i){
+            pfds[2 + i].fd = coprocs[i].fd;
+            pfds[2 + i].events = POLLIN;
+            const long restart = coproc_timeout(&coprocs[i]);
+            if(restart != -1 && (timeout == -1 || restart < timeout)){
+                timeout = restart;
+            }
+        }
+        if(!(dpy && XPending(dpy))){
+            if(poll(pfds, LENGTH(pfds), timeout) == -1){
+                if(errno == EINTR){
+                    continue;
+                }
+                perror("poll");
+                break;
+            }
+        }
+
+        int changed = 0;
+        if(pfds[0].revents & POLLIN){
+            uint64_t count;
+            if(read(update_fd, &count, sizeof(count)) == sizeof(count)){
+                changed = 1;
+            }
+            pfds[0].revents = 0;
+        }
+        if(dpy){
+            changed |= handle_xevents();
+        }
+        for(size_t i=0; i < LENGTH(scripts); ++i){
+            if(pfds[2 + i].revents || coprocs[i].pid == -1){
+                changed |= handle_script(i);
+            }
+        }
+        if(!changed){
+            continue;
+        }
 
         size_t len_status = 0;
+        trace_event(TRACE_RENDER_START, TRACE_NO_BLOCK);
+
+        // Derived blocks first, so that the frame shows them computed from its own samples
+        derive_update(derived, num_derived);
 
         // update block string
         for(int i=0; i < LENGTH(blocks); ++i){
-            pthread_mutex_lock(&blocks[i].mutex_data);
-            if(blocks[i].new){
-                debug_printf("block %d has new data: [%s] %s: %s\n", i, blocks[i].data.color, blocks[i].data.icon, blocks[i].data.text);
-                blocks[i].new = 0;
+            BlockSnapshot snapshot;
+            if(block_read(&blocks[i], &snapshot)){
+                BlockData data = {snapshot.icon, snapshot.has_text ? snapshot.text : NULL, snapshot.stale ? stale_color : snapshot.color, snapshot.value};
+                debug_printf("block %d has new data: [%s] %s: %s\n", i, data.color, data.icon, data.text);
 
                 free(blocks[i].string);
-                blocks[i].string = build_block_string(&blocks[i].data, bar_color);
+                blocks[i].string = build_block_string(&data, bar_color);
                 debug_printf("block %d: %s\n", i, blocks[i].string);
+
+                shm_export_entry(i, blocks[i].name, snapshot.value, snapshot.time, snapshot.stale, data.text, blocks[i].string);
             }
-            pthread_mutex_unlock(&blocks[i].mutex_data);
 
             // update status length
             if(blocks[i].string != NULL){
@@ -592,12 +1365,31 @@ int main(void)
                 strcat(status, blocks[i].string);
             }
         }
-        setstatus(status, dpy);
-        debug_printf("status=%s\n", status);
+        trace_event(TRACE_RENDER_END, TRACE_NO_BLOCK);
 
-        pthread_mutex_unlock(&mutex_cond);
+        trace_event(TRACE_PUSH_START, TRACE_NO_BLOCK);
+        if(dpy){
+            setstatus(status, dpy);
+        }else{
+            printf("%s\n", status);
+            fflush(stdout);
+        }
+        trace_event(TRACE_PUSH_END, TRACE_NO_BLOCK);
+        debug_printf("status=%s\n", status);
+        shm_export_power(policy_on_battery(), policy_wakeups());
+        shm_export_frame();
+
+        if(first_frame){
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            fprintf(stderr, "dwmbar: first frame after %.2fms with %zu/%zu blocks\n",
+                    (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6, ready, expected);
+            first_frame = 0;
+        }
     }
 
-    XCloseDisplay(dpy);
+    if(dpy){
+        XCloseDisplay(dpy);
+    }
 
 }
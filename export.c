@@ -0,0 +1,81 @@
+/*
+ * dwmbar-export: convert time series recorded by dwmbar to CSV.
+ *
+ *   dwmbar-export FILE.ring...
+ *
+ * Prints "time,block,value" lines, time in seconds since the epoch.
+ * Records failing their checksum (interrupted writes) are skipped.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+
+static int export(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        perror(path);
+        return 1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < sizeof(RecorderFile)){
+        fprintf(stderr, "%s: not a dwmbar time series\n", path);
+        close(fd);
+        return 1;
+    }
+
+    const RecorderFile* file = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED){
+        perror("mmap");
+        return 1;
+    }
+
+    if(file->magic != RECORDER_MAGIC || file->version != RECORDER_VERSION || file->record_size != sizeof(RecordEntry)
+       || sizeof(RecorderFile) + (size_t)file->capacity * sizeof(RecordEntry) > st.st_size){
+        fprintf(stderr, "%s: not a dwmbar time series\n", path);
+        munmap((void*)file, st.st_size);
+        return 1;
+    }
+
+    // The oldest records are overwritten once the file is full
+    const uint64_t head = __atomic_load_n(&file->head, __ATOMIC_ACQUIRE);
+    const uint64_t start = head > file->capacity ? head - file->capacity : 0;
+    size_t skipped = 0;
+    for(uint64_t n = start; n < head; ++n){
+        const RecordEntry* record = &file->records[n % file->capacity];
+        if(record->seq != n + 1 || record->check != recorder_checksum(record)){
+            skipped++;
+            continue;
+        }
+        printf("%llu.%09llu,%s,%.17g\n", (unsigned long long)(record->time / 1000000000), (unsigned long long)(record->time % 1000000000),
+               file->name, record->value);
+    }
+    if(skipped){
+        fprintf(stderr, "%s: %zu invalid records skipped\n", path, skipped);
+    }
+
+    munmap((void*)file, st.st_size);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2){
+        fprintf(stderr, "usage: dwmbar-export FILE.ring...\n");
+        return 1;
+    }
+
+    int ret = 0;
+    printf("time,block,value\n");
+    for(int i=1; i < argc; ++i){
+        ret |= export(argv[i]);
+    }
+    return ret;
+}
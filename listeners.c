@@ -1,15 +1,22 @@
 #include "listeners.h"
 
 #include <time.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/inotify.h>
 #include <poll.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 
+#include "pool.h"
+#include "policy.h"
+#include "trace.h"
+#include "debug.h"
 
-void file_listener(Block* blk, const char* file, void (*callback)(Block*), pthread_cond_t* update_cond)
+
+void file_listener(Block* blk, const char* file, void (*callback)(Block*), int update_fd)
 {
     // See man inotify(1) for reference
 
@@ -37,6 +44,8 @@ void file_listener(Block* blk, const char* file, void (*callback)(Block*), pthre
         }
 
         if (poll_num > 0 && pfd.revents & POLLIN) {
+            trace_event(TRACE_WAKE, blk->id);
+
             // It's necessary to parse events to update the volume only on modifications
             char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
             const struct inotify_event *event;
@@ -66,7 +75,7 @@ void file_listener(Block* blk, const char* file, void (*callback)(Block*), pthre
                     event = (const struct inotify_event *) ptr;
 
                     if(event->mask & IN_CLOSE_WRITE){
-                        safe_callback(blk, callback, update_cond);
+                        safe_callback(blk, callback, update_fd);
                     }
 
                 }
@@ -77,7 +86,7 @@ void file_listener(Block* blk, const char* file, void (*callback)(Block*), pthre
 }
 
 
-void aligned_time_listener(time_t align, time_t interval, Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond)
+void aligned_time_listener(time_t align, time_t interval, Block* blk, void (*callback)(Block*), int update_fd)
 {   
 
     // Align the sleep interval on a multiple of [interval] seconds
@@ -104,24 +113,183 @@ void aligned_time_listener(time_t align, time_t interval, Block* blk, void (*cal
             nextSleep = now + interval - (now - nextSleep) % interval;
         }
 
-        safe_callback(blk, callback, update_cond);
+        trace_event(TRACE_WAKE, blk->id);
+        safe_callback(blk, callback, update_fd);
     }
 }
 
-void time_listener(time_t interval, Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond)
+void time_listener(time_t interval, Block* blk, void (*callback)(Block*), int update_fd)
 {   
     while(1){
-        sleep(interval);
+        policy_sleep(interval);
         
-        safe_callback(blk, callback, update_cond);
+        trace_event(TRACE_WAKE, blk->id);
+        safe_callback(blk, callback, update_fd);
+    }
+}
+
+void adaptive_time_listener(time_t (*interval)(Block*), Block* blk, void (*callback)(Block*), int update_fd)
+{
+    // Same as the time listener, but the interval is chosen again before each sleep
+    while(1){
+        policy_sleep(interval(blk));
+
+        trace_event(TRACE_WAKE, blk->id);
+        safe_callback(blk, callback, update_fd);
+    }
+}
+
+void poll_listener(int fd, time_t interval, Block* blk, void (*event_callback)(Block*), void (*callback)(Block*), int update_fd)
+{
+    // Kernel files such as mountinfo, PSI triggers or sysfs attributes report changes with POLLPRI.
+    // A negative fd is ignored by poll, the listener then behaves like a time listener.
+    struct pollfd pfd = {.fd = fd, .events = POLLPRI};
+    while(1){
+        policy_thread();
+        int poll_num = poll(&pfd, 1, policy_timeout(interval));
+        if (poll_num == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+
+        trace_event(TRACE_WAKE, blk->id);
+        if (poll_num == 0){
+            safe_callback(blk, callback, update_fd);
+        }else if (pfd.revents & POLLPRI){
+            safe_callback(blk, event_callback, update_fd);
+        }else{
+            fprintf(stderr, "poll_listener: unexpected events 0x%x on fd %d\n", pfd.revents, fd);
+            return;
+        }
+    }
+}
+
+void psi_listener(const int* fds, size_t nfds, time_t interval, time_t idle_interval, Block* blk, void (*callback)(Block*), int update_fd)
+{
+    // PSI triggers report POLLPRI when their threshold is crossed, and POLLERR when they are destroyed.
+    // The polling interval is reset on each event and stretched up to idle_interval while nothing happens.
+    struct pollfd pfds[nfds];
+    for(size_t i=0; i < nfds; ++i){
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLPRI;
+    }
+
+    time_t timeout = interval;
+    while(1){
+        policy_thread();
+        int poll_num = poll(pfds, nfds, policy_timeout(timeout));
+        if (poll_num == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+
+        trace_event(TRACE_WAKE, blk->id);
+        if (poll_num == 0){
+            timeout = timeout * 2 < idle_interval ? timeout * 2 : idle_interval;
+        }else{
+            for(size_t i=0; i < nfds; ++i){
+                if (pfds[i].revents & (POLLERR | POLLNVAL)){
+                    fprintf(stderr, "psi_listener: trigger on fd %d failed\n", pfds[i].fd);
+                    return;
+                }
+            }
+            timeout = interval;
+        }
+
+        safe_callback(blk, callback, update_fd);
+    }
+}
+
+void sysfs_listener(int fd, long min_interval, long max_interval, Block* blk, void (*callback)(Block*), int update_fd)
+{
+    // Attributes updated with sysfs_notify() report POLLPRI once they changed since their last read.
+    // Until a notification shows up the attribute is polled, every min_interval ms after a change
+    // then twice less often each time it stays the same, up to max_interval ms.
+    // Once a notification is received the attribute is only checked every minute.
+    // On battery the policy stretches these intervals like the other periodic ones.
+    struct pollfd pfd = {.fd = fd, .events = POLLPRI};
+    char last[64] = "";
+    char buf[64];
+    int notified = 0;
+    long timeout = min_interval;
+
+    while(1){
+        // Reading the attribute also re-arms the notification
+        ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+        if(len < 0){
+            perror("sysfs_listener: pread");
+            return;
+        }
+        buf[len] = 0;
+
+        const int changed = strcmp(buf, last) != 0;
+        if(changed){
+            strcpy(last, buf);
+            safe_callback(blk, callback, update_fd);
+        }
+
+        if(notified){
+            timeout = 60000;
+        }else if(changed){
+            timeout = min_interval;
+        }else{
+            timeout = timeout * 2 < max_interval ? timeout * 2 : max_interval;
+        }
+
+        policy_thread();
+        int poll_num = poll(&pfd, 1, policy_timeout_ms(timeout));
+        if (poll_num == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+        trace_event(TRACE_WAKE, blk->id);
+        if (poll_num > 0 && (pfd.revents & POLLPRI) && !notified){
+            debug_printf("[sysfs_listener]: fd %d supports notifications\n", fd);
+            notified = 1;
+        }
+    }
+}
+
+void slow_time_listener(time_t interval, long deadline_ms, Block* blk, void (*callback)(Block*), int update_fd)
+{
+    PoolJob job;
+    pool_job_init(&job, blk, callback, update_fd);
+
+    unsigned int misses = 0;
+    while(1){
+        trace_event(TRACE_WAKE, blk->id);
+        if(pool_run(&job, deadline_ms)){
+            misses = 0;
+        }else if(misses < SLOW_MAX_BACKOFF){
+            misses += 1;
+        }
+
+        // Back off exponentially while the sensor keeps missing its deadline
+        policy_sleep(interval << misses);
+    }
+}
+
+void notify_update(int update_fd)
+{
+    const uint64_t one = 1;
+    if(write(update_fd, &one, sizeof(one)) != sizeof(one)){
+        perror("write(update_fd)");
     }
 }
 
-void safe_callback(Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond)
+void safe_callback(Block* blk, void (*callback)(Block*), int update_fd)
 {
-    pthread_mutex_lock(&blk->mutex_data);
-    blk->new = 1;
+    // The callback works on the block's private scratch data, no lock is held while it runs
+    trace_event(TRACE_CALLBACK_START, blk->id);
     callback(blk);
-    pthread_mutex_unlock(&blk->mutex_data);
-    pthread_cond_signal(update_cond);
+    trace_event(TRACE_CALLBACK_END, blk->id);
+    block_publish(blk);
+    trace_event(TRACE_PUBLISH, blk->id);
+    notify_update(update_fd);
 }
\ No newline at end of file
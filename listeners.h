@@ -1,12 +1,22 @@
 #ifndef LISTENERS_HEADER_TCHEV
 #define LISTENERS_HEADER_TCHEV
 
+#include <time.h>
+
 #include "block.h"
 
-void file_listener(Block* blk, const char* file, void (*callback)(Block*), pthread_cond_t* update_cond);
-void aligned_time_listener(time_t align, time_t interval, Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond);
-void time_listener(time_t interval, Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond);
+#define SLOW_MAX_BACKOFF 4
+
+void file_listener(Block* blk, const char* file, void (*callback)(Block*), int update_fd);
+void aligned_time_listener(time_t align, time_t interval, Block* blk, void (*callback)(Block*), int update_fd);
+void time_listener(time_t interval, Block* blk, void (*callback)(Block*), int update_fd);
+void adaptive_time_listener(time_t (*interval)(Block*), Block* blk, void (*callback)(Block*), int update_fd);
+void poll_listener(int fd, time_t interval, Block* blk, void (*event_callback)(Block*), void (*callback)(Block*), int update_fd);
+void psi_listener(const int* fds, size_t nfds, time_t interval, time_t idle_interval, Block* blk, void (*callback)(Block*), int update_fd);
+void sysfs_listener(int fd, long min_interval, long max_interval, Block* blk, void (*callback)(Block*), int update_fd);
+void slow_time_listener(time_t interval, long deadline_ms, Block* blk, void (*callback)(Block*), int update_fd);
 
-void safe_callback(Block* blk, void (*callback)(Block*), pthread_cond_t* update_cond);
+void notify_update(int update_fd);
+void safe_callback(Block* blk, void (*callback)(Block*), int update_fd);
 
 #endif // LISTENERS_HEADER_TCHEV
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "policy.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+
+/*
+ * Scheduling policy of the periodic blocks, following the power state read by the power block.
+ * On battery the intervals are multiplied by battery_factor and the threads get a large
+ * timer slack, so that the kernel can batch their timers with the other ones.
+ * The periodic listeners sleep until the next multiple of their interval since the epoch:
+ * blocks with intervals multiple of each other wake up together instead of one after the other.
+ */
+
+static time_t battery_factor = 1;
+static long battery_slack = 0;      // ns
+static int on_battery = 0;
+static __thread int thread_battery = -1;  // power state of the current thread's timer slack
+
+void policy_init(time_t factor, long slack_ns)
+{
+    battery_factor = factor > 0 ? factor : 1;
+    battery_slack = slack_ns;
+}
+
+void policy_set_battery(int battery)
+{
+    if(__atomic_exchange_n(&on_battery, battery, __ATOMIC_RELAXED) != battery){
+        debug_printf("[policy]: running on %s\n", battery ? "battery" : "AC");
+    }
+}
+
+int policy_on_battery(void)
+{
+    return __atomic_load_n(&on_battery, __ATOMIC_RELAXED);
+}
+
+/* Interval of a periodic block in the current power state */
+time_t policy_interval(time_t interval)
+{
+    return policy_on_battery() ? interval * battery_factor : interval;
+}
+
+/* Update the timer slack of the calling thread after a power state change, it is per thread */
+void policy_thread(void)
+{
+    const int battery = policy_on_battery();
+    if(battery == thread_battery){
+        return;
+    }
+    // A slack of 0 restores the default of the thread
+    if(prctl(PR_SET_TIMERSLACK, battery ? battery_slack : 0, 0, 0, 0) == -1){
+        perror("prctl(PR_SET_TIMERSLACK)");
+    }
+    thread_battery = battery;
+}
+
+/* Sleep until the next multiple of the block interval, in the current power state */
+void policy_sleep(time_t interval)
+{
+    policy_thread();
+
+    const time_t period = policy_interval(interval);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const struct timespec next = {(now.tv_sec / period + 1) * period, 0};
+    while(clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL) == EINTR);
+}
+
+/* ms until the next multiple of the block interval, for the listeners waiting in poll() */
+long policy_timeout(time_t interval)
+{
+    return policy_timeout_ms(interval * 1000L);
+}
+
+/* Same as policy_timeout() for an interval in ms, such as the polling of sysfs attributes */
+long policy_timeout_ms(long interval_ms)
+{
+    const long long period = policy_on_battery() ? (long long)interval_ms * battery_factor : interval_ms;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return period - (now.tv_sec * 1000LL + now.tv_nsec / 1000000) % period;
+}
+
+/*
+ * Wakeups of all the threads during the last full minute, 0 during the first one.
+ * Only called by the main loop. Each sleep of a thread is a voluntary context switch, getrusage() sums them over the threads.
+ */
+unsigned int policy_wakeups(void)
+{
+    static struct timespec minute_start;
+    static long minute_switches = -1;
+    static unsigned int last_minute = 0;
+
+    struct rusage usage;
+    struct timespec now;
+    if(getrusage(RUSAGE_SELF, &usage) == -1){
+        return last_minute;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(minute_switches == -1){
+        minute_start = now;
+        minute_switches = usage.ru_nvcsw;
+    }else if(now.tv_sec - minute_start.tv_sec >= 60){
+        const double elapsed = (now.tv_sec - minute_start.tv_sec) + (now.tv_nsec - minute_start.tv_nsec) / 1e9;
+        last_minute = (usage.ru_nvcsw - minute_switches) * 60 / elapsed;
+        minute_start = now;
+        minute_switches = usage.ru_nvcsw;
+    }
+    return last_minute;
+}
@@ -0,0 +1,16 @@
+#ifndef POLICY_HEADER_TCHEV
+#define POLICY_HEADER_TCHEV
+
+#include <time.h>
+
+void policy_init(time_t battery_factor, long battery_slack_ns);
+void policy_set_battery(int on_battery);
+int policy_on_battery(void);
+time_t policy_interval(time_t interval);
+void policy_thread(void);
+void policy_sleep(time_t interval);
+long policy_timeout(time_t interval);
+long policy_timeout_ms(long interval_ms);
+unsigned int policy_wakeups(void);
+
+#endif // POLICY_HEADER_TCHEV
@@ -0,0 +1,127 @@
+#include "pool.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "listeners.h"
+#include "debug.h"
+#include "trace.h"
+
+/*
+ * Small bounded pool running the callbacks of slow blocks.
+ * A callback stuck in a hanging read only keeps one worker busy: the listener gives
+ * up waiting after its deadline, marks the block as stale and keeps its last good value.
+ */
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static PoolJob* queue[POOL_QUEUE];
+static size_t queue_start = 0;
+static size_t queue_len = 0;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void* pool_worker(void* unused)
+{
+    while(1){
+        pthread_mutex_lock(&queue_mutex);
+        while(queue_len == 0){
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        }
+        PoolJob* job = queue[queue_start];
+        queue_start = (queue_start + 1) % POOL_QUEUE;
+        queue_len -= 1;
+        pthread_mutex_unlock(&queue_mutex);
+
+        // The callback only touches the block's scratch data, no lock is held here
+        trace_event(TRACE_CALLBACK_START, job->blk->id);
+        job->callback(job->blk);
+        trace_event(TRACE_CALLBACK_END, job->blk->id);
+
+        // Publishing under the job mutex orders it with block_set_stale()
+        pthread_mutex_lock(&job->mutex);
+        job->running = 0;
+        block_publish(job->blk);
+        trace_event(TRACE_PUBLISH, job->blk->id);
+        notify_update(job->update_fd);
+        pthread_cond_signal(&job->done);
+        pthread_mutex_unlock(&job->mutex);
+    }
+    return (void*)0;
+}
+
+static void pool_start(void)
+{
+    pthread_t thread;
+    for(int i=0; i < POOL_WORKERS; ++i){
+        if(pthread_create(&thread, NULL, pool_worker, NULL) != 0){
+            perror("pool: pthread_create");
+        }
+    }
+}
+
+void pool_job_init(PoolJob* job, Block* blk, void (*callback)(Block*), int update_fd)
+{
+    pthread_condattr_t attr;
+
+    job->blk = blk;
+    job->callback = callback;
+    job->update_fd = update_fd;
+    job->running = 0;
+    pthread_mutex_init(&job->mutex, NULL);
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&job->done, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/*
+ * Run the job's callback on the pool and wait at most deadline_ms for it.
+ * Returns 1 if the block was updated in time, 0 otherwise (then the block is marked stale).
+ */
+int pool_run(PoolJob* job, long deadline_ms)
+{
+    pthread_once(&pool_once, pool_start);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += deadline_ms / 1000;
+    deadline.tv_nsec += (deadline_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&job->mutex);
+
+    // Never queue the same block twice, its previous read may still be hanging
+    int in_time = 0;
+    if(!job->running){
+        pthread_mutex_lock(&queue_mutex);
+        if(queue_len < POOL_QUEUE){
+            queue[(queue_start + queue_len) % POOL_QUEUE] = job;
+            queue_len += 1;
+            job->running = 1;
+            pthread_cond_signal(&queue_cond);
+        }
+        pthread_mutex_unlock(&queue_mutex);
+
+        int err = 0;
+        while(job->running && err != ETIMEDOUT){
+            err = pthread_cond_timedwait(&job->done, &job->mutex, &deadline);
+        }
+        in_time = !job->running;
+    }
+
+    if(!in_time){
+        debug_printf("[pool_run]: deadline of %ldms missed\n", deadline_ms);
+        block_set_stale(job->blk);
+        trace_event(TRACE_STALE, job->blk->id);
+        notify_update(job->update_fd);
+    }
+
+    pthread_mutex_unlock(&job->mutex);
+    return in_time;
+}
@@ -0,0 +1,23 @@
+#ifndef POOL_HEADER_TCHEV
+#define POOL_HEADER_TCHEV
+
+#include <pthread.h>
+
+#include "block.h"
+
+#define POOL_WORKERS 2
+#define POOL_QUEUE   8
+
+typedef struct {
+    Block* blk;
+    void (*callback)(Block*);
+    int update_fd;
+    int running;           // the callback is queued or executing on a worker
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+} PoolJob;
+
+void pool_job_init(PoolJob* job, Block* blk, void (*callback)(Block*), int update_fd);
+int pool_run(PoolJob* job, long deadline_ms);
+
+#endif // POOL_HEADER_TCHEV
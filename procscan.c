@@ -0,0 +1,287 @@
+#include "procscan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "utils.h"
+#include "debug.h"
+
+/*
+ * Incremental /proc walker finding the process using the most cpu.
+ * Every process keeps an fd on its /proc/<pid>/stat between scans, so a scan costs one pread
+ * per process instead of an open, a read and a close. The /proc directory itself is only
+ * walked again when the last pid of /proc/loadavg moved, i.e. when processes were created.
+ * Exited processes are dropped when their stat fd fails with ESRCH: the fd is bound to the
+ * process and not to its pid, so a reused pid is never mistaken for the old process. The
+ * processes over the fd budget are opened by pid at each scan, and their start time tells
+ * a reused pid apart.
+ */
+
+#define PROCSCAN_MIN_CAPACITY 1024
+#define PROCSCAN_FD_RESERVE   256   // fds left to the rest of dwmbar
+
+static size_t hash_pid(pid_t pid, size_t capacity)
+{
+    return ((size_t)pid * 2654435761u) & (capacity - 1);
+}
+
+/* Slot of pid, or of the free slot where it should be inserted */
+static ProcEntry* procscan_slot(ProcScan* scan, pid_t pid)
+{
+    ProcEntry* removed = NULL;
+    for(size_t i = hash_pid(pid, scan->capacity); ; i = (i + 1) & (scan->capacity - 1)){
+        ProcEntry* entry = &scan->entries[i];
+        if(entry->pid == pid){
+            return entry;
+        }
+        if(entry->pid == 0){
+            return removed ? removed : entry;
+        }
+        if(entry->pid == -1 && removed == NULL){
+            removed = entry;
+        }
+    }
+}
+
+/* Rebuild the table without the removed slots, larger when it is half full of processes */
+static int procscan_rehash(ProcScan* scan)
+{
+    size_t live = 1;  // the process about to be inserted
+    for(size_t i=0; i < scan->capacity; ++i){
+        live += scan->entries[i].pid > 0;
+    }
+    size_t capacity = scan->capacity;
+    while(live * 2 >= capacity){
+        capacity *= 2;
+    }
+
+    ProcEntry* old = scan->entries;
+    const size_t old_capacity = scan->capacity;
+    scan->entries = calloc(capacity, sizeof(ProcEntry));
+    if(scan->entries == NULL){
+        perror("procscan: calloc");
+        scan->entries = old;
+        return -1;
+    }
+    scan->capacity = capacity;
+    scan->used = 0;
+
+    for(size_t i=0; i < old_capacity; ++i){
+        if(old[i].pid > 0){
+            *procscan_slot(scan, old[i].pid) = old[i];
+            scan->used += 1;
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void procscan_remove(ProcScan* scan, ProcEntry* entry)
+{
+    if(entry->fd != -1){
+        close(entry->fd);
+        scan->num_fds -= 1;
+    }
+    entry->pid = -1;
+}
+
+/* Parse comm, utime + stime, start time and rss, returns -1 when the process is gone */
+static int procscan_read(ProcScan* scan, ProcEntry* entry, unsigned long long* ticks, unsigned long long* start)
+{
+    char buf[1024];
+    ssize_t len;
+    if(entry->fd != -1){
+        len = pread(entry->fd, buf, sizeof(buf) - 1, 0);
+    }else{
+        char path[64];
+        snprintf(path, sizeof(path), "%d/stat", entry->pid);
+        int fd = openat(dirfd(scan->dir), path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            return -1;
+        }
+        len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+    }
+    if(len <= 0){
+        return -1;
+    }
+    buf[len] = 0;
+
+    // The command name is between parentheses and may contain both spaces and parentheses
+    char* open = strchr(buf, '(');
+    char* end = strrchr(buf, ')');
+    if(open == NULL || end == NULL || end < open){
+        return -1;
+    }
+    size_t comm_len = end - open - 1;
+    if(comm_len >= PROCSCAN_COMM_LEN){
+        comm_len = PROCSCAN_COMM_LEN - 1;
+    }
+    memcpy(entry->comm, open + 1, comm_len);
+    entry->comm[comm_len] = 0;
+
+    // Fields 14, 15, 22 and 24 of proc_pid_stat(5)
+    unsigned long long utime, stime;
+    if(sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu %*u %ld",
+              &utime, &stime, start, &entry->rss) != 4){
+        return -1;
+    }
+    *ticks = utime + stime;
+    return 0;
+}
+
+/* Add the processes created since the previous walk, their whole cpu time is new */
+static void procscan_walk(ProcScan* scan, int first)
+{
+    rewinddir(scan->dir);
+    struct dirent* dir;
+    while((dir = readdir(scan->dir)) != NULL){
+        if(!isdigit((unsigned char)dir->d_name[0])){
+            continue;
+        }
+        const pid_t pid = atoi(dir->d_name);
+        ProcEntry* entry = procscan_slot(scan, pid);
+        if(entry->pid == pid){
+            continue;
+        }
+
+        if((scan->used + 1) * 2 > scan->capacity){
+            if(procscan_rehash(scan) == -1){
+                return;
+            }
+            entry = procscan_slot(scan, pid);
+        }
+        if(entry->pid == 0){
+            scan->used += 1;
+        }
+
+        entry->pid = pid;
+        entry->fd = -1;
+        entry->ticks = 0;
+        entry->delta = 0;
+        if(scan->num_fds < scan->fd_budget){
+            char path[64];
+            snprintf(path, sizeof(path), "%d/stat", pid);
+            entry->fd = openat(dirfd(scan->dir), path, O_RDONLY | O_CLOEXEC);
+            scan->num_fds += entry->fd != -1;
+        }
+
+        unsigned long long ticks;
+        if(procscan_read(scan, entry, &ticks, &entry->start) == -1){
+            procscan_remove(scan, entry);
+            continue;
+        }
+        // At the first scan nothing is known about the past, it only sets the baseline
+        entry->ticks = ticks;
+        entry->delta = first ? 0 : ticks;
+    }
+}
+
+/* Last pid allocated by the kernel, the last field of /proc/loadavg */
+static pid_t procscan_last_pid(ProcScan* scan)
+{
+    char buf[128];
+    ssize_t len = pread(scan->loadavg_fd, buf, sizeof(buf) - 1, 0);
+    if(len <= 0){
+        return -1;
+    }
+    buf[len] = 0;
+    char* last = strrchr(buf, ' ');
+    return last ? atoi(last + 1) : -1;
+}
+
+int procscan_init(ProcScan* scan, const char* proc)
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->dir = opendir(proc);
+    if(scan->dir == NULL){
+        perror(proc);
+        return -1;
+    }
+
+    char* loadavg = smprintf("%s/loadavg", proc);
+    scan->loadavg_fd = open(loadavg, O_RDONLY | O_CLOEXEC);
+    free(loadavg);
+    scan->last_pid = -1;
+
+    scan->capacity = PROCSCAN_MIN_CAPACITY;
+    scan->entries = calloc(scan->capacity, sizeof(ProcEntry));
+    if(scan->entries == NULL){
+        perror("procscan: calloc");
+        closedir(scan->dir);
+        scan->dir = NULL;
+        return -1;
+    }
+
+    // The soft limit is left alone, the scripts would inherit a raised one
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+        if(limit.rlim_cur > PROCSCAN_FD_RESERVE){
+            scan->fd_budget = limit.rlim_cur == RLIM_INFINITY ? 65536 : limit.rlim_cur - PROCSCAN_FD_RESERVE;
+        }
+    }
+    debug_printf("[procscan]: %zu persistent fds allowed\n", scan->fd_budget);
+    return 0;
+}
+
+/*
+ * Sample every process and fill top with the one using the most cpu since the previous call.
+ * Returns 0 when top was filled, -1 at the first call or when there is no process.
+ */
+int procscan_update(ProcScan* scan, ProcTop* top)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int first = scan->time.tv_sec == 0 && scan->time.tv_nsec == 0;
+    const double elapsed = (now.tv_sec - scan->time.tv_sec) + (now.tv_nsec - scan->time.tv_nsec) / 1e9;
+    scan->time = now;
+
+    // Without /proc/loadavg the directory is walked at each scan
+    const pid_t last_pid = scan->loadavg_fd != -1 ? procscan_last_pid(scan) : -1;
+    const int walk = first || last_pid == -1 || last_pid != scan->last_pid;
+    scan->last_pid = last_pid;
+
+    ProcEntry* best = NULL;
+    for(size_t i=0; i < scan->capacity; ++i){
+        ProcEntry* entry = &scan->entries[i];
+        if(entry->pid <= 0){
+            continue;
+        }
+        unsigned long long ticks, start;
+        if(procscan_read(scan, entry, &ticks, &start) == -1){
+            procscan_remove(scan, entry);
+            continue;
+        }
+        // A pid read by path may now be another process, whose whole cpu time is new
+        entry->delta = start == entry->start ? ticks - entry->ticks : ticks;
+        entry->ticks = ticks;
+        entry->start = start;
+    }
+
+    // New processes are read by the walk, after the others so that they are not sampled twice
+    if(walk){
+        procscan_walk(scan, first);
+    }
+
+    for(size_t i=0; i < scan->capacity; ++i){
+        ProcEntry* entry = &scan->entries[i];
+        if(entry->pid > 0 && (best == NULL || entry->delta > best->delta)){
+            best = entry;
+        }
+    }
+
+    if(first || best == NULL || elapsed <= 0){
+        return -1;
+    }
+    top->pid = best->pid;
+    memcpy(top->comm, best->comm, PROCSCAN_COMM_LEN);
+    top->cpu = 100.0 * best->delta / (elapsed * sysconf(_SC_CLK_TCK));
+    top->rss = best->rss * sysconf(_SC_PAGESIZE);
+    return 0;
+}
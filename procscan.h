@@ -0,0 +1,42 @@
+#ifndef PROCSCAN_HEADER_TCHEV
+#define PROCSCAN_HEADER_TCHEV
+
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define PROCSCAN_COMM_LEN 16  // TASK_COMM_LEN of the kernel
+
+typedef struct {
+    pid_t pid;                 // 0 for an empty slot, -1 for a removed one
+    int fd;                    // persistent fd on /proc/<pid>/stat, -1 when over the fd budget
+    unsigned long long start;  // start time of the process, tells a reused pid apart without an fd
+    unsigned long long ticks;  // utime + stime at the previous scan
+    unsigned long long delta;  // ticks used since the previous scan
+    long rss;                  // resident pages
+    char comm[PROCSCAN_COMM_LEN];
+} ProcEntry;
+
+typedef struct {
+    DIR* dir;
+    int loadavg_fd;
+    pid_t last_pid;            // last pid allocated at the previous directory walk
+    ProcEntry* entries;        // open addressing hash table indexed by pid
+    size_t capacity;           // power of two
+    size_t used;               // live and removed slots
+    size_t num_fds;
+    size_t fd_budget;          // persistent fds allowed, the others are opened at each scan
+    struct timespec time;      // time of the previous scan, 0 before the first one
+} ProcScan;
+
+typedef struct {
+    pid_t pid;
+    char comm[PROCSCAN_COMM_LEN];
+    double cpu;                // percentage of one cpu since the previous scan
+    long rss;                  // bytes
+} ProcTop;
+
+int procscan_init(ProcScan* scan, const char* proc);
+int procscan_update(ProcScan* scan, ProcTop* top);
+
+#endif // PROCSCAN_HEADER_TCHEV
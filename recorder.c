@@ -0,0 +1,182 @@
+#include "recorder.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+/* FNV-1a over the fields of the record, seq included so a record of a previous lap never matches */
+uint32_t recorder_checksum(const RecordEntry* record)
+{
+    uint32_t hash = 2166136261u;
+    const unsigned char* p = (const unsigned char*)record;
+    for(size_t i=0; i < offsetof(RecordEntry, check); ++i){
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Resolves the directory of the time series and creates it with its parents. A leading ~ is
+ * the home directory, and a relative path is relative to $XDG_DATA_HOME (~/.local/share).
+ * Returns a path to free, or NULL if the directory cannot be created.
+ */
+char* recorder_dir(const char* dir)
+{
+    const char* home = getenv("HOME");
+    const char* data = getenv("XDG_DATA_HOME");
+    char* path;
+    if(dir[0] == '/'){
+        path = smprintf("%s", dir);
+    }else if(dir[0] == '~' && (dir[1] == '/' || dir[1] == 0)){
+        path = smprintf("%s%s", home ? home : "", dir + 1);
+    }else if(data && data[0] == '/'){
+        path = smprintf("%s/%s", data, dir);
+    }else{
+        path = smprintf("%s/.local/share/%s", home ? home : "", dir);
+    }
+
+    for(char* p = path + 1; ; ++p){
+        if(*p == '/' || *p == 0){
+            const char c = *p;
+            *p = 0;
+            if(mkdir(path, 0755) == -1 && errno != EEXIST){
+                perror(path);
+                free(path);
+                return NULL;
+            }
+            *p = c;
+            if(c == 0){
+                break;
+            }
+        }
+    }
+    return path;
+}
+
+Recorder* recorder_open(const char* dir, const char* name, uint32_t block, uint32_t capacity)
+{
+    char* path = smprintf("%s/%s.ring", dir, name);
+    const size_t size = sizeof(RecorderFile) + (size_t)capacity * sizeof(RecordEntry);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd == -1){
+        perror(path);
+        free(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        perror("fstat");
+        close(fd);
+        free(path);
+        return NULL;
+    }
+
+    // A file of another size is restarted from zeros
+    const int fresh = st.st_size != size;
+    if(fresh && (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1)){
+        perror("ftruncate");
+        close(fd);
+        free(path);
+        return NULL;
+    }
+
+    RecorderFile* file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED){
+        perror("mmap");
+        free(path);
+        return NULL;
+    }
+
+    if(fresh || file->magic != RECORDER_MAGIC || file->version != RECORDER_VERSION
+       || file->record_size != sizeof(RecordEntry) || file->capacity != capacity){
+        fprintf(stderr, "recorder: starting a new time series in %s\n", path);
+        memset(file, 0, sizeof(RecorderFile));
+        file->version = RECORDER_VERSION;
+        file->record_size = sizeof(RecordEntry);
+        file->capacity = capacity;
+        strncpy(file->name, name, RECORDER_NAME_LEN - 1);
+        file->magic = RECORDER_MAGIC;
+    }else{
+        // A crash may have happened between writing a record and updating head
+        const RecordEntry* next = &file->records[file->head % capacity];
+        if(next->seq == file->head + 1 && next->check == recorder_checksum(next)){
+            file->head += 1;
+        }
+    }
+    free(path);
+
+    Recorder* rec = malloc(sizeof(Recorder));
+    if(rec == NULL){
+        perror("recorder_open: malloc");
+        munmap(file, size);
+        return NULL;
+    }
+    rec->file = file;
+    rec->block = block;
+    rec->synced = file->head;
+    return rec;
+}
+
+/* Writes back the pages holding the records [from, to), which must not span more than one lap */
+static void recorder_sync(RecorderFile* file, uint64_t from, uint64_t to)
+{
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    while(from < to){
+        // Stop at the end of the file when the range wraps around
+        const uint64_t lap_end = from - from % file->capacity + file->capacity;
+        const uint64_t end = lap_end < to ? lap_end : to;
+        const uintptr_t first = (uintptr_t)&file->records[from % file->capacity];
+        const uintptr_t last = (uintptr_t)&file->records[(end - 1) % file->capacity + 1];
+        const uintptr_t start = first - first % page;
+        if(msync((void*)start, last - start, MS_SYNC) == -1){
+            perror("recorder: msync");
+        }
+        from = end;
+    }
+}
+
+/* Called by the single producer of the block, only touches memory except every RECORDER_SYNC_RECORDS records */
+void recorder_append(Recorder* rec, uint64_t time, double value)
+{
+    RecorderFile* file = rec->file;
+    const uint64_t n = file->head;
+    RecordEntry* record = &file->records[n % file->capacity];
+
+    RecordEntry new = {n + 1, time, value, rec->block, 0};
+    new.check = recorder_checksum(&new);
+
+    // Invalidate the slot first, so that a half written record is never read as valid
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->time = new.time;
+    record->value = new.value;
+    record->block = new.block;
+    record->check = new.check;
+    __atomic_store_n(&record->seq, new.seq, __ATOMIC_RELEASE);
+
+    if(n + 1 - rec->synced < RECORDER_SYNC_RECORDS){
+        __atomic_store_n(&file->head, n + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // The records reach the disk before the head that covers them
+    const uint64_t from = n + 1 - rec->synced > file->capacity ? n + 1 - file->capacity : rec->synced;
+    recorder_sync(file, from, n + 1);
+    __atomic_store_n(&file->head, n + 1, __ATOMIC_RELEASE);
+    if(msync(file, sizeof(RecorderFile), MS_SYNC) == -1){
+        perror("recorder: msync");
+    }
+    rec->synced = n + 1;
+}
@@ -0,0 +1,50 @@
+#ifndef RECORDER_HEADER_TCHEV
+#define RECORDER_HEADER_TCHEV
+
+#include <stdint.h>
+
+/*
+ * Fixed-size circular file of block samples, written through a shared memory mapping
+ * so that appending a sample costs no syscall. The file survives restarts of dwmbar,
+ * and a record is only considered valid once its sequence number is set, so a crash
+ * of dwmbar loses at most the record being written. The mapping is flushed to disk every
+ * RECORDER_SYNC_RECORDS records, which bounds what a power loss can take.
+ */
+
+#define RECORDER_MAGIC    0x43524d57  // "WMRC"
+#define RECORDER_VERSION  1
+#define RECORDER_NAME_LEN 16
+#define RECORDER_SYNC_RECORDS 128
+
+typedef struct {
+    uint64_t seq;        // 1-based index of the record, 0 while it is being written
+    uint64_t time;       // CLOCK_REALTIME of the sample, in ns
+    double   value;
+    uint32_t block;      // index of the block in the bar
+    uint32_t check;      // checksum of the other fields
+} RecordEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;   // number of records in the file
+    uint64_t head;       // number of records ever written
+    char     name[RECORDER_NAME_LEN];
+    uint8_t  pad[24];    // records start on a 64-byte boundary
+    RecordEntry records[];
+} RecorderFile;
+
+typedef struct {
+    RecorderFile* file;
+    uint32_t block;
+    uint64_t synced;     // head at the last flush
+} Recorder;
+
+char* recorder_dir(const char* dir);
+Recorder* recorder_open(const char* dir, const char* name, uint32_t block, uint32_t capacity);
+void recorder_append(Recorder* rec, uint64_t time, double value);
+
+uint32_t recorder_checksum(const RecordEntry* record);
+
+#endif // RECORDER_HEADER_TCHEV
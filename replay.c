@@ -0,0 +1,372 @@
+/*
+ * dwmbar-replay: record the sensor files read by dwmbar, play them back into a
+ * temporary tree and measure dwmbar under load.
+ *
+ *   dwmbar-replay record TRACE INTERVAL_MS COUNT [PATH...]
+ *   dwmbar-replay replay TRACE ROOT [SPEED]
+ *   dwmbar-replay hammer ROOT FILE HZ SECONDS [DWMBAR]
+ *
+ * The trace is a text file made of records "@<ms> <path> <length>\n<content>\n".
+ * A record is only written when the content of the file changed.
+ * replay and hammer work with the DWMBAR_ROOT and DWMBAR_HEADLESS environment
+ * variables of dwmbar: the sensors are read below ROOT and the status is printed on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+#define MAX_PATHS   64
+#define MAX_CONTENT 8192
+#define MAX_PENDING 4096
+#define HAMMER_BASE 1000000000L  // added to the written values, no other block prints numbers this large
+
+static const char* default_paths[] = {
+    "/sys/class/hwmon/*/name",
+    "/sys/class/hwmon/*/fan1_input",
+    "/sys/class/hwmon/*/fan2_input",
+    "/sys/class/hwmon/*/temp1_input",
+    "/sys/class/power_supply/BAT0/status",
+    "/sys/class/power_supply/BAT0/current_now",
+    "/sys/class/power_supply/BAT0/voltage_now",
+    "/sys/class/power_supply/BAT0/present",
+    "/sys/class/power_supply/BAT0/capacity",
+    "/proc/meminfo",
+};
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+/* mkdir -p of the parent directories of path */
+static void make_parents(const char* path)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for(char* p = tmp + 1; *p; ++p){
+        if(*p == '/'){
+            *p = 0;
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+}
+
+/* Overwrite the file in place, so that inotify watches see an IN_CLOSE_WRITE */
+static int write_content(const char* path, const char* content, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1){
+        make_parents(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd == -1){
+            perror(path);
+            return -1;
+        }
+    }
+    if(write(fd, content, len) != (ssize_t)len){
+        perror("write");
+    }
+    close(fd);
+    return 0;
+}
+
+static ssize_t read_content(const char* path, char* buf, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        return -1;
+    }
+    ssize_t len = read(fd, buf, size);
+    close(fd);
+    return len;
+}
+
+static int record(const char* trace, long interval, long count, int argc, char** argv)
+{
+    char* paths[MAX_PATHS];
+    char* last[MAX_PATHS];
+    ssize_t last_len[MAX_PATHS];
+    size_t num_paths = 0;
+
+    // Expand the patterns, the symbolic links of /sys/class/hwmon are kept as directories
+    glob_t g;
+    const size_t num_patterns = argc ? argc : sizeof(default_paths) / sizeof(default_paths[0]);
+    for(size_t i=0; i < num_patterns; ++i){
+        const char* pattern = argc ? argv[i] : default_paths[i];
+        if(glob(pattern, 0, NULL, &g) == 0){
+            for(size_t j=0; j < g.gl_pathc && num_paths < MAX_PATHS; ++j){
+                paths[num_paths] = smprintf("%s", g.gl_pathv[j]);
+                last[num_paths] = calloc(MAX_CONTENT, 1);
+                last_len[num_paths] = -1;
+                num_paths += 1;
+            }
+            globfree(&g);
+        }
+    }
+
+    FILE* out = fopen(trace, "w");
+    if(out == NULL){
+        perror(trace);
+        return 1;
+    }
+
+    char buf[MAX_CONTENT];
+    const long start = now_ms();
+    for(long n=0; n < count; ++n){
+        const long t = now_ms() - start;
+        for(size_t i=0; i < num_paths; ++i){
+            ssize_t len = read_content(paths[i], buf, sizeof(buf));
+            if(len < 0 || (len == last_len[i] && memcmp(buf, last[i], len) == 0)){
+                continue;
+            }
+            fprintf(out, "@%ld %s %zd\n", t, paths[i], len);
+            fwrite(buf, 1, len, out);
+            fputc('\n', out);
+            memcpy(last[i], buf, len);
+            last_len[i] = len;
+        }
+        fflush(out);
+        sleep_ms(start + (n + 1) * interval - now_ms());
+    }
+
+    fclose(out);
+    printf("recorded %zu files %ld times in %s\n", num_paths, count, trace);
+    return 0;
+}
+
+static int replay(const char* trace, const char* root, double speed)
+{
+    FILE* in = fopen(trace, "r");
+    if(in == NULL){
+        perror(trace);
+        return 1;
+    }
+
+    char path[4096];
+    char buf[MAX_CONTENT];
+    long t;
+    size_t len;
+    size_t records = 0;
+    const long start = now_ms();
+    while(fscanf(in, "@%ld %4095s %zu", &t, path, &len) == 3){
+        fgetc(in);
+        if(len > sizeof(buf) || fread(buf, 1, len, in) != len){
+            fprintf(stderr, "truncated trace %s\n", trace);
+            break;
+        }
+        fgetc(in);
+
+        const long delay = start + (long)(t / speed) - now_ms();
+        if(delay > 0){
+            sleep_ms(delay);
+        }
+
+        char* dest = smprintf("%s%s", root, path);
+        write_content(dest, buf, len);
+        free(dest);
+        records += 1;
+    }
+
+    fclose(in);
+    printf("replayed %zu records into %s\n", records, root);
+    return 0;
+}
+
+static double process_cpu_seconds(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    ssize_t len = read_content(path, buf, sizeof(buf) - 1);
+    if(len <= 0){
+        return 0;
+    }
+    buf[len] = 0;
+
+    // Fields 14 and 15 are utime and stime, counted after the command name
+    char* p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if(p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2){
+        return 0;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Write increasing integers to ROOT/FILE at the given rate while dwmbar runs headless,
+ * and match every printed "<n>%" with the time n was written.
+ */
+static int hammer(const char* root, const char* file, double hz, double seconds, const char* dwmbar)
+{
+    char* target = smprintf("%s%s", root, file);
+    write_content(target, "0\n", 2);
+
+    int pipefd[2];
+    if(pipe(pipefd) == -1){
+        perror("pipe");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if(pid == -1){
+        perror("fork");
+        return 1;
+    }
+    if(pid == 0){
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        setenv("DWMBAR_ROOT", root, 1);
+        setenv("DWMBAR_HEADLESS", "1", 1);
+        execl(dwmbar, dwmbar, (char*)NULL);
+        perror(dwmbar);
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    // Let dwmbar start its listeners before measuring
+    sleep_ms(500);
+
+    static double written[MAX_PENDING];
+    static double latencies[MAX_PENDING * 16];
+    size_t num_latencies = 0;
+    long next_value = 1;
+    long last_seen = 0;
+    size_t frames = 0;
+
+    char line[65536];
+    size_t line_len = 0;
+
+    const double period = 1e6 / hz;
+    const double cpu_start = process_cpu_seconds(pid);
+    const double start = now_us();
+    double next_write = start;
+    struct pollfd pfd = {.fd = pipefd[0], .events = POLLIN};
+
+    while(now_us() - start < seconds * 1e6){
+        if(now_us() >= next_write){
+            char value[32];
+            int len = snprintf(value, sizeof(value), "%ld\n", HAMMER_BASE + next_value);
+            written[next_value % MAX_PENDING] = now_us();
+            write_content(target, value, len);
+            next_value += 1;
+            next_write += period;
+        }
+
+        int timeout = (int)((next_write - now_us()) / 1000);
+        if(poll(&pfd, 1, timeout > 0 ? timeout : 0) > 0){
+            ssize_t len = read(pipefd[0], line + line_len, sizeof(line) - 1 - line_len);
+            if(len <= 0){
+                fprintf(stderr, "dwmbar exited\n");
+                break;
+            }
+            line_len += len;
+            line[line_len] = 0;
+
+            char* eol;
+            while((eol = strchr(line, '\n')) != NULL){
+                const double t = now_us();
+                *eol = 0;
+                frames += 1;
+
+                // The newest written value displayed in this frame. The other blocks also print
+                // percentages (battery, brightness, top), only numbers above HAMMER_BASE are ours
+                for(char* p = line; *p; ++p){
+                    char* end;
+                    long v = strtol(p, &end, 10) - HAMMER_BASE;
+                    if(end != p && *end == '%' && v > last_seen && v < next_value && next_value - v < MAX_PENDING){
+                        if(num_latencies < sizeof(latencies) / sizeof(latencies[0])){
+                            latencies[num_latencies++] = t - written[v % MAX_PENDING];
+                        }
+                        last_seen = v;
+                    }
+                    if(end != p){
+                        p = end - 1;
+                    }
+                }
+
+                line_len -= eol + 1 - line;
+                memmove(line, eol + 1, line_len + 1);
+            }
+        }
+    }
+
+    const double elapsed = (now_us() - start) / 1e6;
+    const double cpu = process_cpu_seconds(pid) - cpu_start;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    printf("writes:   %ld in %.2fs (%.0f Hz)\n", next_value - 1, elapsed, (next_value - 1) / elapsed);
+    printf("frames:   %zu (%.0f Hz)\n", frames, frames / elapsed);
+    printf("cpu:      %.3fs (%.1f%%)\n", cpu, 100 * cpu / elapsed);
+    if(num_latencies){
+        qsort(latencies, num_latencies, sizeof(double), compare_double);
+        printf("latency:  %zu samples, p50 %.0fus, p99 %.0fus, max %.0fus\n", num_latencies,
+               latencies[num_latencies / 2], latencies[num_latencies * 99 / 100], latencies[num_latencies - 1]);
+    }
+
+    free(target);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: dwmbar-replay record TRACE INTERVAL_MS COUNT [PATH...]\n"
+                    "       dwmbar-replay replay TRACE ROOT [SPEED]\n"
+                    "       dwmbar-replay hammer ROOT FILE HZ SECONDS [DWMBAR]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2){
+        usage();
+    }
+
+    if(strcmp(argv[1], "record") == 0 && argc >= 5){
+        return record(argv[2], atol(argv[3]), atol(argv[4]), argc - 5, argv + 5);
+    }else if(strcmp(argv[1], "replay") == 0 && argc >= 4){
+        return replay(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 1.0);
+    }else if(strcmp(argv[1], "hammer") == 0 && argc >= 6){
+        return hammer(argv[2], argv[3], atof(argv[4]), atof(argv[5]), argc > 6 ? argv[6] : "./dwmbar");
+    }
+
+    usage();
+    return 1;
+}
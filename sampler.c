@@ -0,0 +1,358 @@
+#include "sampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "uring.h"
+#include "utils.h"
+#include "listeners.h"
+#include "policy.h"
+#include "debug.h"
+#include "trace.h"
+
+/*
+ * Sampler of the periodic sysfs blocks.
+ * Every attribute is opened once and registered in an io_uring. The ticks of all the blocks are
+ * aligned on multiples of their interval, so that every attribute due at the same time is read
+ * with one io_uring_enter() call. The callbacks then parse the buffers with sampler_read().
+ * A block whose reads miss their deadline is marked stale like with pool_run(), its callback
+ * runs whenever the reads complete.
+ * Without io_uring the blocks keep their own listener, and sampler_read() preads the attribute.
+ */
+
+#define WAKE_DATA UINT64_MAX  // user_data of the poll on wake_fd
+
+typedef struct {
+    char* path;
+    int fd;
+    int inflight;                  // a read is queued or running in the kernel
+    int res;                       // result of the last read, length or -errno
+    char buf[SAMPLER_ATTR_LEN];
+} SamplerAttr;
+
+typedef struct {
+    Block* blk;
+    void (*callback)(Block*);
+    int update_fd;
+    time_t interval;
+    long deadline_ms;
+    int attrs[SAMPLER_BLOCK_ATTRS];
+    size_t num_attrs;
+    long long due;                 // ms since the epoch of the next sample
+    long long submitted;           // ms since the epoch of the pending sample, 0 when none
+    int late;                      // the pending sample missed its deadline
+    unsigned int misses;
+} SamplerBlock;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static SamplerAttr attrs[SAMPLER_ATTRS];
+static size_t num_attrs = 0;
+static SamplerBlock blocks[SAMPLER_BLOCKS];
+static size_t num_blocks = 0;
+
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static Uring ring;
+static int ring_ok = 0;
+static int wake_fd = -1;           // eventfd telling the sampler thread that a block was added
+static pthread_t thread;
+static int thread_started = 0;     // thread is valid
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* First multiple of interval seconds strictly after t, in ms */
+static long long next_tick(long long t, time_t interval)
+{
+    const long long period = interval * 1000LL;
+    return (t / period + 1) * period;
+}
+
+static void ring_init(void)
+{
+    // The slow read hook only works with blocking reads, testing deadlines needs the pool
+    if(getenv("DWMBAR_NO_URING") || getenv("DWMBAR_SLOW_READ")){
+        return;
+    }
+    if(uring_init(&ring, 2 * SAMPLER_ATTRS) == -1){
+        debug_printf("[sampler]: io_uring not available\n");
+        return;
+    }
+
+    int fds[SAMPLER_ATTRS];
+    for(size_t i=0; i < SAMPLER_ATTRS; ++i){
+        fds[i] = -1;
+    }
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(wake_fd == -1 || uring_register_files(&ring, fds, SAMPLER_ATTRS) == -1){
+        return;
+    }
+    ring_ok = 1;
+}
+
+int sampler_available(void)
+{
+    pthread_once(&ring_once, ring_init);
+    return ring_ok;
+}
+
+/* Open an attribute once, returns its id or -1 */
+int sampler_attr(const char* path)
+{
+    if(path == NULL){
+        return -1;
+    }
+    sampler_available();
+
+    pthread_mutex_lock(&mutex);
+    int id = -1;
+    for(size_t i=0; i < num_attrs && id == -1; ++i){
+        if(strcmp(attrs[i].path, path) == 0){
+            id = i;
+        }
+    }
+    if(id == -1 && num_attrs < SAMPLER_ATTRS){
+        SamplerAttr* attr = &attrs[num_attrs];
+        attr->path = smprintf("%s", path);
+        attr->fd = open(path, O_RDONLY | O_CLOEXEC);
+        attr->inflight = 0;
+        attr->res = -ENODATA;
+        if(attr->fd == -1){
+            perror(path);
+        }else if(ring_ok){
+            uring_update_file(&ring, num_attrs, attr->fd);
+        }
+        id = num_attrs++;
+    }
+    pthread_mutex_unlock(&mutex);
+    return id;
+}
+
+/*
+ * Content of an attribute, to be freed, or NULL like read_file().
+ * On the sampler thread this is the value read at this tick, elsewhere the attribute is read now.
+ */
+char* sampler_read(int attr)
+{
+    if(attr < 0){
+        return NULL;
+    }
+    SamplerAttr* a = &attrs[attr];
+    if(a->fd == -1){
+        return NULL;
+    }
+
+    if(__atomic_load_n(&thread_started, __ATOMIC_ACQUIRE) && pthread_equal(pthread_self(), thread)){
+        if(a->res <= 0){
+            fprintf(stderr, "sampler: cannot read %s: %s\n", a->path, strerror(a->res ? -a->res : ENODATA));
+            return NULL;
+        }
+        return smprintf("%.*s", a->res, a->buf);
+    }
+
+    read_delay(a->path);
+    char buf[SAMPLER_ATTR_LEN];
+    ssize_t len = pread(a->fd, buf, sizeof(buf), 0);
+    if(len <= 0){
+        fprintf(stderr, "sampler: cannot read %s\n", a->path);
+        return NULL;
+    }
+    return smprintf("%.*s", (int)len, buf);
+}
+
+/* Queue the reads of the blocks due, returns the time the thread must wake up at */
+static long long sampler_queue(long long now, unsigned int* queued)
+{
+    long long wake = now + 60000;
+    for(size_t i=0; i < num_blocks; ++i){
+        SamplerBlock* b = &blocks[i];
+        if(!b->submitted && b->due <= now){
+            trace_event(TRACE_WAKE, b->blk->id);
+            for(size_t j=0; j < b->num_attrs; ++j){
+                SamplerAttr* a = &attrs[b->attrs[j]];
+                // A read still hanging from a previous tick is not queued twice
+                if(a->fd != -1 && !a->inflight){
+                    if(uring_queue_read(&ring, b->attrs[j], a->buf, sizeof(a->buf), b->attrs[j]) == 0){
+                        a->inflight = 1;
+                        *queued += 1;
+                    }else{
+                        a->res = -EBUSY;
+                    }
+                }
+            }
+            b->submitted = now;
+            b->late = 0;
+            b->due = next_tick(now, policy_interval(b->interval) << b->misses);
+        }
+
+        if(b->submitted && !b->late && b->submitted + b->deadline_ms < wake){
+            wake = b->submitted + b->deadline_ms;
+        }
+        if(!b->submitted && b->due < wake){
+            wake = b->due;
+        }
+    }
+    return wake;
+}
+
+/* Whether a submitted block has no read in flight, e.g. none of its attributes could be opened */
+static int sampler_ready(void)
+{
+    for(size_t i=0; i < num_blocks; ++i){
+        const SamplerBlock* b = &blocks[i];
+        int done = b->submitted != 0;
+        for(size_t j=0; j < b->num_attrs && done; ++j){
+            done = !attrs[b->attrs[j]].inflight;
+        }
+        if(done){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Run the callbacks of the blocks whose reads all completed, and mark the late ones stale */
+static void sampler_dispatch(long long now)
+{
+    for(size_t i=0; i < num_blocks; ++i){
+        SamplerBlock* b = &blocks[i];
+        if(!b->submitted){
+            continue;
+        }
+
+        int done = 1;
+        for(size_t j=0; j < b->num_attrs && done; ++j){
+            done = !attrs[b->attrs[j]].inflight;
+        }
+
+        if(done){
+            b->submitted = 0;
+            if(!b->late){
+                b->misses = 0;
+            }
+            safe_callback(b->blk, b->callback, b->update_fd);
+        }else if(!b->late && now >= b->submitted + b->deadline_ms){
+            debug_printf("[sampler]: deadline of %ldms missed by %s\n", b->deadline_ms, b->blk->name);
+            b->late = 1;
+            if(b->misses < SLOW_MAX_BACKOFF){
+                b->misses += 1;
+            }
+            // Back off exponentially while the sensor keeps missing its deadline
+            b->due = next_tick(b->submitted, policy_interval(b->interval) << b->misses);
+            block_set_stale(b->blk);
+            trace_event(TRACE_STALE, b->blk->id);
+            notify_update(b->update_fd);
+        }
+    }
+}
+
+static void* sampler_thread(void* unused)
+{
+    int wake_armed = 0;
+
+    while(1){
+        if(!wake_armed){
+            wake_armed = uring_queue_poll(&ring, wake_fd, WAKE_DATA) == 0;
+        }
+        policy_thread();
+
+        unsigned int queued = 0;
+        pthread_mutex_lock(&mutex);
+        const long long now = now_ms();
+        const long long wake = sampler_queue(now, &queued);
+        const int ready = sampler_ready();
+        pthread_mutex_unlock(&mutex);
+
+        // One call submits every read of the tick and waits for all of them,
+        // reads still hanging from an earlier tick are not waited for. A block
+        // that needs no read is dispatched right away, its reads are waited for
+        // at the next iteration
+        const long timeout = ready || wake <= now ? 0 : wake - now;
+        int err = uring_submit_and_wait(&ring, ready ? 0 : queued ? queued : 1, timeout);
+        if(err < 0 && err != -ETIME && err != -EBUSY){
+            fprintf(stderr, "sampler: io_uring_enter: %s\n", strerror(-err));
+            return (void*)0;
+        }
+
+        uint64_t user_data;
+        int res;
+        while(uring_reap(&ring, &user_data, &res)){
+            if(user_data == WAKE_DATA){
+                uint64_t count;
+                if(read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+                    perror("sampler: read(wake_fd)");
+                }
+                wake_armed = 0;
+            }else{
+                attrs[user_data].res = res;
+                attrs[user_data].inflight = 0;
+            }
+        }
+
+        pthread_mutex_lock(&mutex);
+        sampler_dispatch(now_ms());
+        pthread_mutex_unlock(&mutex);
+    }
+    return (void*)0;
+}
+
+/*
+ * Sample the block every interval seconds, its first sample is taken right away.
+ * Returns -1 when io_uring is not available, the caller then keeps its own listener.
+ */
+int sampler_add(Block* blk, time_t interval, long deadline_ms, const int* attr_ids, size_t num_attr_ids,
+                void (*callback)(Block*), int update_fd)
+{
+    if(!sampler_available()){
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if(num_blocks == SAMPLER_BLOCKS || num_attr_ids > SAMPLER_BLOCK_ATTRS){
+        pthread_mutex_unlock(&mutex);
+        fprintf(stderr, "sampler: cannot add block %s\n", blk->name);
+        return -1;
+    }
+
+    SamplerBlock* b = &blocks[num_blocks];
+    b->blk = blk;
+    b->callback = callback;
+    b->update_fd = update_fd;
+    b->interval = interval;
+    b->deadline_ms = deadline_ms;
+    b->num_attrs = 0;
+    for(size_t i=0; i < num_attr_ids; ++i){
+        if(attr_ids[i] != -1){
+            b->attrs[b->num_attrs++] = attr_ids[i];
+        }
+    }
+    b->due = 0;
+    b->submitted = 0;
+    b->late = 0;
+    b->misses = 0;
+    num_blocks += 1;
+
+    if(!thread_started){
+        if(pthread_create(&thread, NULL, sampler_thread, NULL) != 0){
+            perror("sampler: pthread_create");
+            num_blocks -= 1;
+            pthread_mutex_unlock(&mutex);
+            return -1;
+        }
+        __atomic_store_n(&thread_started, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    notify_update(wake_fd);
+    return 0;
+}
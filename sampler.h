@@ -0,0 +1,19 @@
+#ifndef SAMPLER_HEADER_TCHEV
+#define SAMPLER_HEADER_TCHEV
+
+#include <time.h>
+
+#include "block.h"
+
+#define SAMPLER_ATTRS       32  // sysfs attributes kept open
+#define SAMPLER_BLOCKS      8   // blocks driven by the sampler
+#define SAMPLER_BLOCK_ATTRS 4   // attributes read by one block
+#define SAMPLER_ATTR_LEN    64  // longest attribute value read
+
+int sampler_attr(const char* path);
+char* sampler_read(int attr);
+int sampler_available(void);
+int sampler_add(Block* blk, time_t interval, long deadline_ms, const int* attrs, size_t num_attrs,
+                void (*callback)(Block*), int update_fd);
+
+#endif // SAMPLER_HEADER_TCHEV
@@ -0,0 +1,182 @@
+#include "shm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static ShmHeader* export = NULL;
+
+static size_t shm_size(size_t num_entries)
+{
+    return sizeof(ShmHeader) + num_entries * sizeof(ShmEntry);
+}
+
+static void copy_string(char* dest, const char* src, size_t size)
+{
+    if(src == NULL){
+        dest[0] = 0;
+        return;
+    }
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = 0;
+}
+
+/* Create or reuse the shared memory object, returns 0 on success */
+int shm_export_open(size_t num_entries)
+{
+    int fd = shm_open(DWMBAR_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd == -1){
+        perror("shm_open");
+        return -1;
+    }
+    if(ftruncate(fd, shm_size(num_entries)) == -1){
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    export = mmap(NULL, shm_size(num_entries), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(export == MAP_FAILED){
+        perror("mmap");
+        export = NULL;
+        return -1;
+    }
+
+    // Readers of a previous dwmbar may still be mapped: invalidate the header before rewriting it
+    __atomic_store_n(&export->magic, 0, __ATOMIC_RELEASE);
+    memset(export->entries, 0, num_entries * sizeof(ShmEntry));
+    export->version = DWMBAR_SHM_VERSION;
+    export->entry_size = sizeof(ShmEntry);
+    export->num_entries = num_entries;
+    __atomic_store_n(&export->magic, DWMBAR_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void shm_export_entry(size_t i, const char* name, double value, uint64_t time, int stale, const char* text, const char* string)
+{
+    if(export == NULL || i >= export->num_entries){
+        return;
+    }
+
+    ShmEntry* entry = &export->entries[i];
+    const uint32_t seq = entry->seq;
+
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->stale = stale;
+    entry->value = value;
+    entry->time = time;
+    copy_string(entry->name, name, sizeof(entry->name));
+    copy_string(entry->text, text, sizeof(entry->text));
+    copy_string(entry->string, string, sizeof(entry->string));
+
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Signal the end of a frame. The wake is unconditional: a count of waiting readers kept in
+ * the object would stay wrong forever once a reader is killed while waiting, and one
+ * FUTEX_WAKE without waiter per frame is cheap.
+ */
+void shm_export_frame(void)
+{
+    if(export == NULL){
+        return;
+    }
+
+    __atomic_add_fetch(&export->generation, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &export->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void shm_export_power(int on_battery, uint32_t wakeups)
+{
+    if(export == NULL){
+        return;
+    }
+    __atomic_store_n(&export->on_battery, on_battery, __ATOMIC_RELAXED);
+    __atomic_store_n(&export->wakeups, wakeups, __ATOMIC_RELAXED);
+}
+
+/* Map the object exported by a running dwmbar, NULL if there is none */
+const ShmHeader* dwmbar_shm_open(void)
+{
+    int fd = shm_open(DWMBAR_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    if(fd == -1){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < sizeof(ShmHeader)){
+        close(fd);
+        return NULL;
+    }
+
+    const ShmHeader* shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED){
+        return NULL;
+    }
+
+    if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != DWMBAR_SHM_MAGIC || shm->version != DWMBAR_SHM_VERSION
+       || shm->entry_size != sizeof(ShmEntry) || shm_size(shm->num_entries) > st.st_size){
+        munmap((void*)shm, st.st_size);
+        return NULL;
+    }
+    return shm;
+}
+
+/* Copy a consistent snapshot of entry i, returns 1 on success */
+int dwmbar_shm_read(const ShmHeader* shm, size_t i, ShmEntry* entry)
+{
+    if(i >= shm->num_entries){
+        return 0;
+    }
+
+    const ShmEntry* src = &shm->entries[i];
+    for(int tries = 0; tries < 1000; ++tries){
+        const uint32_t begin = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if(begin & 1){
+            continue;
+        }
+        memcpy(entry, src, sizeof(*entry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == begin){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Index of the entry called name, -1 if there is none */
+int dwmbar_shm_find(const ShmHeader* shm, const char* name)
+{
+    ShmEntry entry;
+    for(size_t i=0; i < shm->num_entries; ++i){
+        if(dwmbar_shm_read(shm, i, &entry) && strcmp(entry.name, name) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Wait until a frame after generation is exported, or timeout_ms (-1 for no timeout). Returns the current generation. */
+uint32_t dwmbar_shm_wait(const ShmHeader* shm, uint32_t generation, long timeout_ms)
+{
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+    // FUTEX_WAIT only reads the word, it returns at once if the generation already moved
+    if(__atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE) == generation){
+        syscall(SYS_futex, &shm->generation, FUTEX_WAIT, generation, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+    }
+
+    return __atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,54 @@
+#ifndef SHM_HEADER_TCHEV
+#define SHM_HEADER_TCHEV
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Live block values exported by dwmbar in the POSIX shared memory object DWMBAR_SHM_NAME.
+ * Each entry is protected by a seqlock written by dwmbar only, so readers never block it
+ * and never need a syscall. generation is incremented after each frame and can be
+ * waited on as a futex. Readers map the object read-only.
+ */
+
+#define DWMBAR_SHM_NAME       "/dwmbar"
+#define DWMBAR_SHM_MAGIC      0x52424d57  // "WMBR"
+#define DWMBAR_SHM_VERSION    3
+#define DWMBAR_SHM_NAME_LEN   16
+#define DWMBAR_SHM_TEXT_LEN   128
+#define DWMBAR_SHM_STRING_LEN 512
+
+typedef struct {
+    uint32_t seq;                          // odd while dwmbar writes the entry
+    uint32_t stale;                        // the value is the last good one, the sensor missed its deadline
+    double   value;                        // raw numeric value, NAN when there is none
+    uint64_t time;                         // CLOCK_REALTIME of the sample, in ns
+    char     name[DWMBAR_SHM_NAME_LEN];
+    char     text[DWMBAR_SHM_TEXT_LEN];    // text of the block
+    char     string[DWMBAR_SHM_STRING_LEN];// rendered status2d string
+} ShmEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t num_entries;
+    uint32_t generation;                   // futex word, incremented after every frame
+    uint32_t on_battery;                   // power state followed by the scheduling policy
+    uint32_t wakeups;                      // wakeups of dwmbar's threads during the last minute
+    ShmEntry entries[];
+} ShmHeader;
+
+/* writer, used by dwmbar */
+int shm_export_open(size_t num_entries);
+void shm_export_entry(size_t i, const char* name, double value, uint64_t time, int stale, const char* text, const char* string);
+void shm_export_frame(void);
+void shm_export_power(int on_battery, uint32_t wakeups);
+
+/* reader library */
+const ShmHeader* dwmbar_shm_open(void);
+int dwmbar_shm_read(const ShmHeader* shm, size_t i, ShmEntry* entry);
+int dwmbar_shm_find(const ShmHeader* shm, const char* name);
+uint32_t dwmbar_shm_wait(const ShmHeader* shm, uint32_t generation, long timeout_ms);
+
+#endif // SHM_HEADER_TCHEV
@@ -0,0 +1,83 @@
+/*
+ * dwmbar-shm: print the block values exported by a running dwmbar.
+ *
+ *   dwmbar-shm [-w] [-s] [-p] [BLOCK...]
+ *
+ * -w prints the values again after every frame, -s prints the rendered status2d strings,
+ * -p prints the power state and the wakeups of dwmbar during the last minute.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "shm.h"
+
+static void print_entry(const ShmEntry* entry, int rendered)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const double age = ((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec - entry->time) / 1e9;
+
+    if(isnan(entry->value)){
+        printf("%-12s %12s %8.1fs%s  %s\n", entry->name, "-", age, entry->stale ? " stale" : "", rendered ? entry->string : entry->text);
+    }else{
+        printf("%-12s %12.2f %8.1fs%s  %s\n", entry->name, entry->value, age, entry->stale ? " stale" : "", rendered ? entry->string : entry->text);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int watch = 0;
+    int rendered = 0;
+    int power = 0;
+    int first = 1;
+    while(first < argc && argv[first][0] == '-'){
+        if(strcmp(argv[first], "-w") == 0){
+            watch = 1;
+        }else if(strcmp(argv[first], "-s") == 0){
+            rendered = 1;
+        }else if(strcmp(argv[first], "-p") == 0){
+            power = 1;
+        }else{
+            fprintf(stderr, "usage: dwmbar-shm [-w] [-s] [-p] [BLOCK...]\n");
+            return 1;
+        }
+        first++;
+    }
+
+    const ShmHeader* shm = dwmbar_shm_open();
+    if(shm == NULL){
+        fprintf(stderr, "dwmbar-shm: no dwmbar shared memory\n");
+        return 1;
+    }
+
+    uint32_t generation = __atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE);
+    do{
+        if(power){
+            printf("%-12s %12u wakeups/min\n", __atomic_load_n(&shm->on_battery, __ATOMIC_RELAXED) ? "battery" : "AC",
+                   __atomic_load_n(&shm->wakeups, __ATOMIC_RELAXED));
+        }
+        ShmEntry entry;
+        for(size_t i=0; i < shm->num_entries; ++i){
+            if(!dwmbar_shm_read(shm, i, &entry) || entry.name[0] == 0){
+                continue;
+            }
+            int wanted = first == argc;
+            for(int j=first; j < argc && !wanted; ++j){
+                wanted = strcmp(argv[j], entry.name) == 0;
+            }
+            if(wanted){
+                print_entry(&entry, rendered);
+            }
+        }
+        if(watch){
+            printf("\n");
+            fflush(stdout);
+            generation = dwmbar_shm_wait(shm, generation, -1);
+        }
+    }while(watch);
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    uint64_t head;          // number of events ever written, only written by the owning thread
+    uint32_t tid;
+    TraceEvent events[TRACE_EVENTS];
+} TraceRing;
+
+static __thread TraceRing* ring = NULL;
+static TraceRing* rings[TRACE_THREADS];
+static uint32_t num_rings = 0;
+
+static char names[TRACE_BLOCKS][TRACE_NAME_LEN];
+static uint32_t num_names = 0;
+static char dump_path[4096];
+
+static TraceRing* trace_ring(void)
+{
+    const uint32_t i = __atomic_fetch_add(&num_rings, 1, __ATOMIC_RELAXED);
+    if(i >= TRACE_THREADS){
+        return NULL;
+    }
+
+    TraceRing* r = calloc(1, sizeof(TraceRing));
+    if(r == NULL){
+        return NULL;
+    }
+    r->tid = syscall(SYS_gettid);
+    __atomic_store_n(&rings[i], r, __ATOMIC_RELEASE);
+    return r;
+}
+
+void trace_event(uint16_t type, uint16_t block)
+{
+    if(ring == NULL){
+        ring = trace_ring();
+        if(ring == NULL){
+            return;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    TraceEvent* event = &ring->events[ring->head & (TRACE_EVENTS - 1)];
+    event->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    event->type = type;
+    event->block = block;
+    event->tid = ring->tid;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Only uses async-signal-safe functions, the rings keep being written during the dump */
+static void trace_dump(int sig)
+{
+    const int saved_errno = errno;
+    // Never follow or reuse a file planted at the path, the previous dump is replaced
+    unlink(dump_path);
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if(fd == -1){
+        errno = saved_errno;
+        return;
+    }
+
+    uint32_t threads = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    threads = threads < TRACE_THREADS ? threads : TRACE_THREADS;
+    for(uint32_t i=0; i < threads; ++i){
+        if(__atomic_load_n(&rings[i], __ATOMIC_ACQUIRE) == NULL){
+            threads = i;
+        }
+    }
+
+    const TraceDumpHeader header = {TRACE_MAGIC, TRACE_VERSION, num_names, threads};
+    ssize_t ret = write(fd, &header, sizeof(header));
+    ret = write(fd, names, num_names * TRACE_NAME_LEN);
+
+    for(uint32_t i=0; i < threads; ++i){
+        const TraceRing* r = rings[i];
+        const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        const uint64_t start = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+        const TraceDumpThread thread = {r->tid, head - start};
+        ret = write(fd, &thread, sizeof(thread));
+
+        // Oldest events first: the end of the buffer then its beginning
+        const uint64_t first = start & (TRACE_EVENTS - 1);
+        if(first + thread.num_events > TRACE_EVENTS){
+            ret = write(fd, &r->events[first], (TRACE_EVENTS - first) * sizeof(TraceEvent));
+            ret = write(fd, r->events, (thread.num_events - (TRACE_EVENTS - first)) * sizeof(TraceEvent));
+        }else{
+            ret = write(fd, &r->events[first], thread.num_events * sizeof(TraceEvent));
+        }
+    }
+    (void)ret;
+
+    close(fd);
+    errno = saved_errno;
+}
+
+void trace_init(const char** block_names, uint32_t num_blocks)
+{
+    num_names = num_blocks < TRACE_BLOCKS ? num_blocks : TRACE_BLOCKS;
+    for(uint32_t i=0; i < num_names; ++i){
+        strncpy(names[i], block_names[i], TRACE_NAME_LEN - 1);
+    }
+
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if(runtime && runtime[0] == '/'){
+        snprintf(dump_path, sizeof(dump_path), "%s/%s.%d", runtime, TRACE_DUMP_NAME, (int)getpid());
+    }else{
+        char dir[] = "/tmp/dwmbar-XXXXXX";
+        if(mkdtemp(dir) == NULL){
+            perror("trace: mkdtemp");
+            return;
+        }
+        snprintf(dump_path, sizeof(dump_path), "%s/%s.%d", dir, TRACE_DUMP_NAME, (int)getpid());
+        fprintf(stderr, "trace: SIGUSR1 dumps to %s\n", dump_path);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_dump;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGUSR1, &sa, NULL) == -1){
+        perror("sigaction(SIGUSR1)");
+    }
+}
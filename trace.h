@@ -0,0 +1,58 @@
+#ifndef TRACE_HEADER_TCHEV
+#define TRACE_HEADER_TCHEV
+
+#include <stdint.h>
+
+/*
+ * In-process event tracing. Each thread appends fixed-size events to its own ring buffer
+ * without any lock or syscall. SIGUSR1 dumps every ring to TRACE_DUMP_NAME.<pid> in
+ * $XDG_RUNTIME_DIR (or a private directory in /tmp), which trace2json converts to the
+ * Chrome trace / Perfetto JSON format.
+ */
+
+#define TRACE_EVENTS    4096         // events kept per thread, must be a power of two
+#define TRACE_THREADS   64
+#define TRACE_BLOCKS    64
+#define TRACE_NAME_LEN  16
+#define TRACE_MAGIC     0x52544d57   // "WMTR"
+#define TRACE_VERSION   1
+#define TRACE_DUMP_NAME "dwmbar-trace"
+#define TRACE_NO_BLOCK  0xffff
+
+enum {
+    TRACE_WAKE,             // a listener woke up
+    TRACE_CALLBACK_START,
+    TRACE_CALLBACK_END,
+    TRACE_PUBLISH,          // a block published new data
+    TRACE_STALE,            // a slow block missed its deadline
+    TRACE_RENDER_START,
+    TRACE_RENDER_END,
+    TRACE_PUSH_START,       // status sent to X (or stdout)
+    TRACE_PUSH_END,
+    TRACE_NUM_TYPES
+};
+
+typedef struct {
+    uint64_t time;          // CLOCK_MONOTONIC, in ns
+    uint16_t type;
+    uint16_t block;         // index of the block, TRACE_NO_BLOCK for global events
+    uint32_t tid;
+} TraceEvent;
+
+/* Dump layout: TraceDumpHeader, block names, then for each thread a TraceDumpThread and its events */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_blocks;
+    uint32_t num_threads;
+} TraceDumpHeader;
+
+typedef struct {
+    uint32_t tid;
+    uint32_t num_events;
+} TraceDumpThread;
+
+void trace_init(const char** names, uint32_t num_blocks);
+void trace_event(uint16_t type, uint16_t block);
+
+#endif // TRACE_HEADER_TCHEV
@@ -0,0 +1,90 @@
+/*
+ * trace2json: convert a dwmbar trace dump to the Chrome trace event format,
+ * which can be opened in chrome://tracing or ui.perfetto.dev.
+ *
+ *   kill -USR1 $(pidof dwmbar)
+ *   trace2json $XDG_RUNTIME_DIR/dwmbar-trace.<pid> > trace.json
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+static const struct {
+    const char* name;
+    char phase;      // 'B' begins a slice, 'E' ends it, 'i' is an instant event
+} types[TRACE_NUM_TYPES] = {
+    [TRACE_WAKE]           = {"wake", 'i'},
+    [TRACE_CALLBACK_START] = {"callback", 'B'},
+    [TRACE_CALLBACK_END]   = {"callback", 'E'},
+    [TRACE_PUBLISH]        = {"publish", 'i'},
+    [TRACE_STALE]          = {"stale", 'i'},
+    [TRACE_RENDER_START]   = {"render", 'B'},
+    [TRACE_RENDER_END]     = {"render", 'E'},
+    [TRACE_PUSH_START]     = {"push", 'B'},
+    [TRACE_PUSH_END]       = {"push", 'E'},
+};
+
+int main(int argc, char** argv)
+{
+    if(argc != 2){
+        fprintf(stderr, "usage: trace2json DUMP\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if(in == NULL){
+        perror(argv[1]);
+        return 1;
+    }
+
+    TraceDumpHeader header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION
+       || header.num_blocks > TRACE_BLOCKS){
+        fprintf(stderr, "%s: not a dwmbar trace\n", argv[1]);
+        return 1;
+    }
+
+    char names[TRACE_BLOCKS][TRACE_NAME_LEN];
+    if(fread(names, TRACE_NAME_LEN, header.num_blocks, in) != header.num_blocks){
+        fprintf(stderr, "%s: truncated trace\n", argv[1]);
+        return 1;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    int first = 1;
+    for(uint32_t t=0; t < header.num_threads; ++t){
+        TraceDumpThread thread;
+        if(fread(&thread, sizeof(thread), 1, in) != 1){
+            fprintf(stderr, "%s: truncated trace\n", argv[1]);
+            break;
+        }
+
+        for(uint32_t e=0; e < thread.num_events; ++e){
+            TraceEvent event;
+            if(fread(&event, sizeof(event), 1, in) != 1){
+                fprintf(stderr, "%s: truncated trace\n", argv[1]);
+                break;
+            }
+            if(event.type >= TRACE_NUM_TYPES){
+                continue;
+            }
+
+            printf("%s{\"name\":\"%s", first ? "" : ",\n", types[event.type].name);
+            if(event.block < header.num_blocks){
+                printf(" %.*s", TRACE_NAME_LEN, names[event.block]);
+            }
+            printf("\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", types[event.type].phase, event.time / 1e3, event.tid);
+            if(types[event.type].phase == 'i'){
+                printf(",\"s\":\"t\"");
+            }
+            printf("}");
+            first = 0;
+        }
+    }
+    printf("\n]}\n");
+
+    fclose(in);
+    return 0;
+}
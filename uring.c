@@ -0,0 +1,170 @@
+#include "uring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * Returns 0 on success, -1 when io_uring is not usable: not built in the kernel,
+ * disabled by io_uring_disabled, or too old to wait with a timeout (before 5.11).
+ */
+int uring_init(Uring* ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(SYS_io_uring_setup, entries, &p);
+    if(ring->fd == -1){
+        return -1;
+    }
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)){
+        close(ring->fd);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+
+    char* rings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(rings == MAP_FAILED){
+        close(ring->fd);
+        return -1;
+    }
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        munmap(rings, size);
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->entries  = p.sq_entries;
+    ring->sq_head  = (unsigned int*)(rings + p.sq_off.head);
+    ring->sq_tail  = (unsigned int*)(rings + p.sq_off.tail);
+    ring->sq_mask  = (unsigned int*)(rings + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(rings + p.sq_off.array);
+    ring->cq_head  = (unsigned int*)(rings + p.cq_off.head);
+    ring->cq_tail  = (unsigned int*)(rings + p.cq_off.tail);
+    ring->cq_mask  = (unsigned int*)(rings + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*)(rings + p.cq_off.cqes);
+    return 0;
+}
+
+/* Register the file table once, fds of -1 leave an empty slot filled later by uring_update_file() */
+int uring_register_files(Uring* ring, const int* fds, unsigned int num_fds)
+{
+    if(syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, num_fds) == -1){
+        perror("io_uring_register");
+        return -1;
+    }
+    return 0;
+}
+
+int uring_update_file(Uring* ring, unsigned int file_index, int fd)
+{
+    struct io_uring_files_update update = {file_index, 0, (uint64_t)(uintptr_t)&fd};
+    if(syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1){
+        perror("io_uring_register(FILES_UPDATE)");
+        return -1;
+    }
+    return 0;
+}
+
+/* Next free sqe cleared, or NULL when the submission queue is full */
+static struct io_uring_sqe* uring_get_sqe(Uring* ring)
+{
+    const unsigned int tail = *ring->sq_tail;
+    if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries){
+        return NULL;
+    }
+
+    const unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+static void uring_push_sqe(Uring* ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->queued += 1;
+}
+
+/* Queue a read at offset 0 of a registered file, returns -1 when the submission queue is full */
+int uring_queue_read(Uring* ring, int file_index, void* buf, unsigned int len, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = file_index;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->user_data = user_data;
+    uring_push_sqe(ring);
+    return 0;
+}
+
+/* Queue a one shot POLLIN on a regular fd, returns -1 when the submission queue is full */
+int uring_queue_poll(Uring* ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+    uring_push_sqe(ring);
+    return 0;
+}
+
+/*
+ * Submit the queued reads and wait for wait_nr completions, at most timeout_ms.
+ * A single io_uring_enter call, returns 0 or -errno (-ETIME on timeout).
+ */
+int uring_submit_and_wait(Uring* ring, unsigned int wait_nr, long timeout_ms)
+{
+    struct __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    const unsigned int to_submit = ring->queued;
+    int ret;
+    do{
+        ret = syscall(SYS_io_uring_enter, ring->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }while(ret == -1 && errno == EINTR);
+
+    if(ret == -1){
+        return -errno;
+    }
+    ring->queued -= ret < to_submit ? ret : to_submit;
+    return 0;
+}
+
+/* Pop one completion, returns 0 when there is none */
+int uring_reap(Uring* ring, uint64_t* user_data, int* res)
+{
+    const unsigned int head = *ring->cq_head;
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+        return 0;
+    }
+
+    const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef URING_HEADER_TCHEV
+#define URING_HEADER_TCHEV
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper issuing reads on registered files, without liburing */
+
+typedef struct {
+    int fd;
+    unsigned int entries;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int queued;    // sqes queued since the last submission
+} Uring;
+
+int uring_init(Uring* ring, unsigned int entries);
+int uring_register_files(Uring* ring, const int* fds, unsigned int num_fds);
+int uring_update_file(Uring* ring, unsigned int file_index, int fd);
+int uring_queue_read(Uring* ring, int file_index, void* buf, unsigned int len, uint64_t user_data);
+int uring_queue_poll(Uring* ring, int fd, uint64_t user_data);
+int uring_submit_and_wait(Uring* ring, unsigned int wait_nr, long timeout_ms);
+int uring_reap(Uring* ring, uint64_t* user_data, int* res);
+
+#endif // URING_HEADER_TCHEV
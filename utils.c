@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "debug.h"
 
 #include <stdlib.h>  // malloc, perror
 #include <stdio.h>   // vsnprintf
@@ -8,6 +9,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
 
 char* smprintf(char *fmt, ...)
 {
@@ -60,12 +63,49 @@ char* strip(char *str){
     return stripped;
 }
 
+/*
+ * Testing hook simulating slow sensors without a FUSE filesystem.
+ * DWMBAR_SLOW_READ="fan1_input:300,capacity:50" delays every read_file() of a path
+ * containing "fan1_input" by 300ms and of a path containing "capacity" by 50ms.
+ */
+void read_delay(const char *path)
+{
+    const char* spec = getenv("DWMBAR_SLOW_READ");
+    if(spec == NULL){
+        return;
+    }
+
+    while(*spec){
+        const char* colon = strchr(spec, ':');
+        if(colon == NULL){
+            return;
+        }
+        char* end;
+        long ms = strtol(colon + 1, &end, 10);
+
+        size_t len = colon - spec;
+        char pattern[len + 1];
+        memcpy(pattern, spec, len);
+        pattern[len] = 0;
+
+        if(strstr(path, pattern) != NULL){
+            struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+            nanosleep(&delay, NULL);
+            return;
+        }
+
+        spec = (*end == ',') ? end + 1 : end;
+    }
+}
+
 char* read_file(const char *path)
 {
     if(!path){
         return NULL;
     }
 
+    read_delay(path);
+
     FILE *fd = fopen(path, "r");
     if (fd == NULL){
         fprintf(stderr, "fopen: unknown file '%s'", path);
@@ -189,6 +229,16 @@ static char* find_in_dir(char* path, char* hwmon_name, char* file)
     return found_path;
 }
 
+/*
+ * Prefix an absolute sysfs, procfs or script path with the DWMBAR_ROOT directory,
+ * so that dwmbar can run against a recorded or simulated tree.
+ */
+char* root_path(const char* path)
+{
+    const char* root = getenv("DWMBAR_ROOT");
+    return smprintf("%s%s", root ? root : "", path);
+}
+
 char* find_sensor(char* path, char* hwmon_name, char* file)
 {
     DIR           *d;
@@ -210,6 +260,45 @@ char* find_sensor(char* path, char* hwmon_name, char* file)
 }
 
 
+/* Path of the first directory (or link to one) in path, such as a /sys/class/backlight device */
+char* find_subdir(const char* path)
+{
+    DIR           *d;
+    struct dirent *dir;
+    char* found_path = NULL;
+
+    d = opendir(path);
+    if (d){
+        while ((dir = readdir(d)) != NULL && !found_path){
+            if((dir->d_type == DT_DIR || dir->d_type == DT_LNK) && strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0){
+                found_path = smprintf("%s/%s", path, dir->d_name);
+            }
+        }
+        closedir(d);
+    }
+    return found_path;
+}
+
+/*
+ * Register a PSI trigger such as "some 150000 2000000" on a /proc/pressure file.
+ * Returns a fd reporting POLLPRI when the threshold is crossed, or -1 when PSI is unavailable.
+ */
+int psi_open(const char* path, const char* trigger)
+{
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(fd == -1){
+        debug_printf("[psi_open]: cannot open %s\n", path);
+        return -1;
+    }
+
+    if(write(fd, trigger, strlen(trigger) + 1) == -1){
+        fprintf(stderr, "psi_open: cannot register trigger '%s' on %s: %s\n", trigger, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 void setstatus(char *str, Display* dpy)
 {
     XStoreName(dpy, DefaultRootWindow(dpy), str);
@@ -8,12 +8,17 @@
 char* smprintf(char *fmt, ...);
 char* strip(char*);
 char* read_file(const char *path);
+void read_delay(const char *path);
 int is_num(char* str);
 int all_space(char *str);
 
 char* build_block_string(BlockData* data, const char* bar_color);
 
+char* root_path(const char* path);
 char* find_sensor(char* path, char* hwmon_name, char* file);
+char* find_subdir(const char* path);
+
+int psi_open(const char* path, const char* trigger);
 
 void setstatus(char *str, Display* dpy);
 